@@ -0,0 +1,250 @@
+/**
+ * @file aesd-circular-buffer-concurrent.c
+ * @brief Single-producer/multi-reader circular buffer with per-slot sequence counters
+ *
+ * The writer publishes each slot like a seqlock (odd sequence while writing, then the even
+ * sequence of the new entry) and then publishes the entry count with a release store.
+ * Readers never write shared state: they load the entry count with acquire semantics, copy
+ * what they need from a slot and check that its sequence did not change meanwhile.
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#include <asm/barrier.h>
+#define aesd_buffer_alloc(size) kzalloc(size, GFP_KERNEL)
+#define aesd_buffer_release(ptr) kfree(ptr)
+#define aesd_read_once(x) READ_ONCE(x)
+#define aesd_write_once(x, val) WRITE_ONCE(x, val)
+#define aesd_load_acquire(p) smp_load_acquire(p)
+#define aesd_store_release(p, val) smp_store_release(p, val)
+#define aesd_rmb() smp_rmb()
+#define aesd_wmb() smp_wmb()
+#else
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#define aesd_buffer_alloc(size) calloc(1, size)
+#define aesd_buffer_release(ptr) free(ptr)
+#define aesd_read_once(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define aesd_write_once(x, val) __atomic_store_n(&(x), val, __ATOMIC_RELAXED)
+#define aesd_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define aesd_store_release(p, val) __atomic_store_n(p, val, __ATOMIC_RELEASE)
+#define aesd_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define aesd_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+#include "aesd-circular-buffer-concurrent.h"
+
+/**
+ * @return the sequence value of a slot holding entry number @param n
+ */
+static inline unsigned long aesd_concurrent_seq(unsigned long n)
+{
+    return 2 * (n + 1);
+}
+
+/**
+ * Copy entry number @param n out of its slot into @param ref.
+ * @return true if the slot held entry @param n for the whole copy
+ */
+static bool aesd_concurrent_slot_read(const struct aesd_concurrent_buffer *buffer, unsigned long n,
+            struct aesd_concurrent_ref *ref)
+{
+    const struct aesd_concurrent_slot *slot = &buffer->slot[n & buffer->mask];
+    unsigned long seq = aesd_concurrent_seq(n);
+
+    if (aesd_load_acquire(&slot->seq) != seq)
+        return false;
+    ref->n = n;
+    ref->entry.buffptr = aesd_read_once(slot->entry.buffptr);
+    ref->entry.size = aesd_read_once(slot->entry.size);
+    ref->start = aesd_read_once(slot->start);
+    aesd_rmb();
+    return aesd_read_once(slot->seq) == seq;
+}
+
+/**
+* Initializes @param buffer to an empty buffer of @param capacity entries, rounded up to a power
+* of two.  Must not be used until this returns; release with aesd_concurrent_buffer_free().
+* @return 0 on success, -EINVAL for a zero capacity or -ENOMEM if the slots could not be allocated.
+*/
+int aesd_concurrent_buffer_init(struct aesd_concurrent_buffer *buffer, unsigned int capacity)
+{
+    unsigned int slots = 1;
+
+    if (!buffer || capacity == 0 || capacity > (~0u >> 1) + 1)
+        return -EINVAL;
+    while (slots < capacity)
+        slots <<= 1;
+
+    memset(buffer, 0, sizeof(*buffer));
+    buffer->slot = aesd_buffer_alloc(slots * sizeof(*buffer->slot));
+    if (!buffer->slot)
+        return -ENOMEM;
+    buffer->mask = slots - 1;
+    return 0;
+}
+
+/**
+* Releases the slots of @param buffer.  No reader may still be using it; memory referenced by
+* the entries is the caller's to free.
+*/
+void aesd_concurrent_buffer_free(struct aesd_concurrent_buffer *buffer)
+{
+    if (!buffer)
+        return;
+    aesd_buffer_release(buffer->slot);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+/**
+* Adds entry @param add_entry to @param buffer, overwriting the oldest entry once the buffer is
+* full.  Only one writer may call this at a time (the caller serializes writers); readers need
+* no locking.
+* @param evicted_rtn if not NULL, receives the overwritten entry so its memory can be reclaimed
+*      once no reader can be copying from it.
+* @return true if an entry was evicted
+*/
+bool aesd_concurrent_buffer_add_entry(struct aesd_concurrent_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry, struct aesd_buffer_entry *evicted_rtn)
+{
+    if (!buffer || !add_entry)
+        return false;
+
+    unsigned long n = buffer->head;
+    struct aesd_concurrent_slot *slot = &buffer->slot[n & buffer->mask];
+    bool evicted = n > buffer->mask;
+
+    if (evicted && evicted_rtn)
+        *evicted_rtn = slot->entry;
+
+    // Mark the slot as changing before touching it, so readers of the old entry notice
+    aesd_write_once(slot->seq, aesd_concurrent_seq(n) - 1);
+    aesd_wmb();
+    aesd_write_once(slot->entry.buffptr, add_entry->buffptr);
+    aesd_write_once(slot->entry.size, add_entry->size);
+    aesd_write_once(slot->start, buffer->end_offset);
+    aesd_store_release(&slot->seq, aesd_concurrent_seq(n));
+    buffer->end_offset += add_entry->size;
+
+    // Publish the entry: its slot happens-before any reader that observes the new head
+    aesd_store_release(&buffer->head, n + 1);
+    // Order the eviction before the caller reuses the evicted entry's memory, so a reader that
+    // sees reused bytes also sees the new slot sequence when it validates
+    aesd_wmb();
+    return evicted;
+}
+
+/**
+* Looks up the entry holding stream offset @param offset and copies it into @param ref.
+* Lock-free: retries only when the writer evicted an entry the lookup was using.
+* @return 0 on success, -ENOENT if @param offset has not been written yet, or -ESTALE if the
+*      entry holding it has already been evicted.
+*/
+int aesd_concurrent_buffer_find(const struct aesd_concurrent_buffer *buffer, size_t offset,
+            struct aesd_concurrent_ref *ref)
+{
+    struct aesd_concurrent_ref probe;
+
+    if (!buffer || !ref)
+        return -EINVAL;
+
+    while (1) {
+        unsigned long head = aesd_load_acquire(&buffer->head);
+        if (head == 0)
+            return -ENOENT;
+
+        unsigned long low = head > buffer->mask ? head - buffer->mask - 1 : 0;
+        unsigned long high = head - 1;
+
+        if (!aesd_concurrent_slot_read(buffer, high, &probe))
+            continue;
+        if (offset >= probe.start + probe.entry.size)
+            return -ENOENT;
+        if (!aesd_concurrent_slot_read(buffer, low, &probe))
+            continue; // The oldest entry was just evicted, start over from the new head
+        if (offset < probe.start)
+            return -ESTALE;
+
+        // Binary search for the last entry starting at or before offset.  Empty entries share
+        // their start with the following entry, so they are never the one found.
+        bool raced = false;
+        while (low < high) {
+            unsigned long mid = low + (high - low + 1) / 2;
+            if (!aesd_concurrent_slot_read(buffer, mid, &probe)) {
+                raced = true;
+                break;
+            }
+            if (probe.start <= offset)
+                low = mid;
+            else
+                high = mid - 1;
+        }
+        if (raced || !aesd_concurrent_slot_read(buffer, low, ref))
+            continue;
+        return 0;
+    }
+}
+
+/**
+* Advances @param ref, as returned by aesd_concurrent_buffer_find(), to the following entry,
+* for sequential readers that do not need a search.
+* @return 0 on success, -ENOENT if there is no following entry yet, or -ESTALE if it has already
+*      been evicted.
+*/
+int aesd_concurrent_buffer_next(const struct aesd_concurrent_buffer *buffer,
+            struct aesd_concurrent_ref *ref)
+{
+    struct aesd_concurrent_ref next;
+
+    if (!buffer || !ref)
+        return -EINVAL;
+    if (ref->n + 1 >= aesd_load_acquire(&buffer->head))
+        return -ENOENT;
+    // Already published, so a failed read means a newer entry has taken the slot
+    if (!aesd_concurrent_slot_read(buffer, ref->n + 1, &next))
+        return -ESTALE;
+    *ref = next;
+    return 0;
+}
+
+/**
+* @return true if the entry copied into @param ref is still in @param buffer, i.e. everything
+*      read through ref->entry.buffptr before this call was read before the entry was evicted.
+*/
+bool aesd_concurrent_buffer_valid(const struct aesd_concurrent_buffer *buffer,
+            const struct aesd_concurrent_ref *ref)
+{
+    const struct aesd_concurrent_slot *slot = &buffer->slot[ref->n & buffer->mask];
+
+    aesd_rmb();
+    return aesd_read_once(slot->seq) == aesd_concurrent_seq(ref->n);
+}
+
+/**
+* Copies up to @param len bytes from stream offset @param offset into @param dst, stopping at
+* the end of the entry holding @param offset.
+* @return the number of bytes copied, or a negative errno as for aesd_concurrent_buffer_find();
+*      -ESTALE also if the entry was evicted while it was being copied, in which case the
+*      contents of @param dst are undefined.
+*/
+ssize_t aesd_concurrent_buffer_read(const struct aesd_concurrent_buffer *buffer, size_t offset,
+            char *dst, size_t len)
+{
+    struct aesd_concurrent_ref ref;
+    int rc = aesd_concurrent_buffer_find(buffer, offset, &ref);
+
+    if (rc < 0)
+        return rc;
+
+    size_t skip = offset - ref.start;
+    size_t count = ref.entry.size - skip;
+    if (count > len)
+        count = len;
+    memcpy(dst, ref.entry.buffptr + skip, count);
+    if (!aesd_concurrent_buffer_valid(buffer, &ref))
+        return -ESTALE;
+    return count;
+}
@@ -0,0 +1,105 @@
+/*
+ * aesd-circular-buffer-concurrent.h
+ *
+ * Single-producer/multi-reader variant of the aesd circular buffer.
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_CONCURRENT_H
+#define AESD_CIRCULAR_BUFFER_CONCURRENT_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdbool.h>
+#include <sys/types.h> // ssize_t
+#endif
+
+#include "aesd-circular-buffer.h"
+
+/**
+ * One slot of the concurrent buffer, guarded by its own sequence counter.
+ * seq is 2 * (n + 1) while the slot holds entry number n, and odd while the writer is
+ * replacing it, so a reader that expects entry n can tell a stable slot from one that is
+ * being (or has been) overwritten.
+ */
+struct aesd_concurrent_slot
+{
+    unsigned long seq;
+    /**
+     * The entry, as passed to aesd_concurrent_buffer_add_entry()
+     */
+    struct aesd_buffer_entry entry;
+    /**
+     * Offset of the entry's first byte in the stream of every byte ever added
+     */
+    size_t start;
+};
+
+/**
+ * Circular buffer that one writer appends to while any number of readers look entries up
+ * without taking a lock.  Entries are numbered from 0 in the order they are added and are
+ * addressed by stream offset: the offset of a byte counting every byte ever added, so the
+ * offset of a given byte never changes as older entries are evicted.
+ *
+ * Readers work on copies of the slot contents and validate them against the slot sequence
+ * counter, detecting entries evicted (and possibly overwritten) during the lookup or copy.
+ * The writer must not free the buffptr of an evicted entry while readers may still be
+ * copying from it: defer the free (kfree_rcu()/synchronize_rcu() in the kernel, with
+ * readers in rcu_read_lock()), or recycle the memory as in the userspace stress test,
+ * where validation then discards any copy that raced with the reuse.
+ */
+struct aesd_concurrent_buffer
+{
+    /**
+     * mask + 1 slots, a power of two
+     */
+    struct aesd_concurrent_slot *slot;
+    unsigned int mask;
+    /**
+     * Number of entries ever added, published with release semantics once the newest
+     * entry's slot is complete
+     */
+    unsigned long head;
+    /**
+     * Stream offset just past the newest entry, only used by the writer
+     */
+    size_t end_offset;
+};
+
+/**
+ * A reader's validated copy of one entry
+ */
+struct aesd_concurrent_ref
+{
+    /**
+     * Entry number
+     */
+    unsigned long n;
+    struct aesd_buffer_entry entry;
+    /**
+     * Stream offset of entry.buffptr[0]
+     */
+    size_t start;
+};
+
+extern int aesd_concurrent_buffer_init(struct aesd_concurrent_buffer *buffer, unsigned int capacity);
+
+extern void aesd_concurrent_buffer_free(struct aesd_concurrent_buffer *buffer);
+
+extern bool aesd_concurrent_buffer_add_entry(struct aesd_concurrent_buffer *buffer,
+            const struct aesd_buffer_entry *add_entry, struct aesd_buffer_entry *evicted_rtn);
+
+extern int aesd_concurrent_buffer_find(const struct aesd_concurrent_buffer *buffer, size_t offset,
+            struct aesd_concurrent_ref *ref);
+
+extern int aesd_concurrent_buffer_next(const struct aesd_concurrent_buffer *buffer,
+            struct aesd_concurrent_ref *ref);
+
+extern bool aesd_concurrent_buffer_valid(const struct aesd_concurrent_buffer *buffer,
+            const struct aesd_concurrent_ref *ref);
+
+extern ssize_t aesd_concurrent_buffer_read(const struct aesd_concurrent_buffer *buffer, size_t offset,
+            char *dst, size_t len);
+
+#endif /* AESD_CIRCULAR_BUFFER_CONCURRENT_H */
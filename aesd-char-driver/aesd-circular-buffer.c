@@ -10,12 +10,74 @@
 
 #ifdef __KERNEL__
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+#define aesd_buffer_alloc(size) kzalloc(size, GFP_KERNEL)
+#define aesd_buffer_release(ptr) kfree(ptr)
 #else
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#define aesd_buffer_alloc(size) calloc(1, size)
+#define aesd_buffer_release(ptr) free(ptr)
 #endif
 
 #include "aesd-circular-buffer.h"
 
+/**
+ * @return the number of entries currently stored in @param buffer
+ */
+unsigned int aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return buffer->capacity;
+    return (buffer->in_offs - buffer->out_offs) & buffer->mask;
+}
+
+/**
+ * @return the offset of the first byte of entry @param index within @param buffer
+ */
+static size_t aesd_circular_buffer_entry_pos(const struct aesd_circular_buffer *buffer, unsigned int index)
+{
+    return buffer->entry_start[index] - buffer->entry_start[buffer->out_offs];
+}
+
+/**
+ * @return true if entry @param index holds @param char_offset, setting @param entry_offset_byte_rtn
+ */
+static bool aesd_circular_buffer_entry_holds(const struct aesd_circular_buffer *buffer, unsigned int index,
+            size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    size_t pos = aesd_circular_buffer_entry_pos(buffer, index);
+
+    if (char_offset < pos || char_offset - pos >= buffer->entry[index].size)
+        return false;
+    *entry_offset_byte_rtn = char_offset - pos;
+    return true;
+}
+
+/**
+ * Binary search for the last of the @param count entries of @param buffer starting at or before
+ * @param char_offset.  Empty entries share their start with the following entry, so they are
+ * never the one found.
+ * @return the slot index of that entry
+ */
+static unsigned int aesd_circular_buffer_search(const struct aesd_circular_buffer *buffer, unsigned int count,
+            size_t char_offset)
+{
+    unsigned int low = 0, high = count - 1;
+
+    while (low < high) {
+        unsigned int mid = low + (high - low + 1) / 2;
+        unsigned int index = (buffer->out_offs + mid) & buffer->mask;
+        if (aesd_circular_buffer_entry_pos(buffer, index) <= char_offset)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return (buffer->out_offs + low) & buffer->mask;
+}
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -25,6 +87,10 @@
  *      in aesd_buffer.
  * @return the struct aesd_buffer_entry structure representing the position described by char_offset, or
  * NULL if this position is not available in the buffer (not enough data is written).
+ *
+ * The entry found by the previous lookup and the one after it are checked first, so sequential
+ * reads take constant time; any other offset is found by a binary search over the entry start
+ * offsets kept by aesd_circular_buffer_add_entry().
  */
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
@@ -32,35 +98,114 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     if (!buffer || !entry_offset_byte_rtn)
     return NULL;
 
-    size_t total_offset = 0;
-    uint8_t index = buffer->out_offs;
-    uint8_t entries_checked = 0;
-
-    // Determine how many entries to check
-    uint8_t entries_to_check = buffer->full ? 
-                            AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : 
-                            ((buffer->in_offs >= buffer->out_offs) ? 
-                            (buffer->in_offs - buffer->out_offs) : 
-                            (AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs + buffer->in_offs));
-
-    while (entries_checked < entries_to_check) {
-        if (char_offset < total_offset + buffer->entry[index].size) {
-            // Found the entry containing the offset
-            *entry_offset_byte_rtn = char_offset - total_offset;
-            return &buffer->entry[index];
+    unsigned int count = aesd_circular_buffer_count(buffer);
+    if (count == 0 || char_offset >= aesd_circular_buffer_total_size(buffer))
+        return NULL;
+
+    // Sequential fast path: the entry of the last lookup, or the one right after it
+    unsigned int hint = buffer->lookup_hint;
+    unsigned int hint_logical = (hint - buffer->out_offs) & buffer->mask;
+    if (hint_logical < count) {
+        if (aesd_circular_buffer_entry_holds(buffer, hint, char_offset, entry_offset_byte_rtn))
+            return &buffer->entry[hint];
+        unsigned int next = (hint + 1) & buffer->mask;
+        if (hint_logical + 1 < count &&
+            aesd_circular_buffer_entry_holds(buffer, next, char_offset, entry_offset_byte_rtn)) {
+            buffer->lookup_hint = next;
+            return &buffer->entry[next];
         }
-        
-        total_offset += buffer->entry[index].size;
-        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        entries_checked++;
     }
-    return NULL;
+
+    unsigned int index = aesd_circular_buffer_search(buffer, count, char_offset);
+    if (!aesd_circular_buffer_entry_holds(buffer, index, char_offset, entry_offset_byte_rtn))
+        return NULL;
+    buffer->lookup_hint = index;
+    return &buffer->entry[index];
+}
+
+/**
+* Removes the oldest entry of the non-empty @param buffer, storing it in @param evicted_rtn if not NULL.
+*/
+static void aesd_circular_buffer_pop(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *evicted_rtn)
+{
+    if (evicted_rtn)
+        *evicted_rtn = buffer->entry[buffer->out_offs];
+    buffer->out_offs = (buffer->out_offs + 1) & buffer->mask;
+    buffer->full = false;
+}
+
+/**
+* Stores @param add_entry after the newest entry of @param buffer, which must not be full.
+*/
+static void aesd_circular_buffer_push(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
+{
+    // Add the new entry at the current in_offs position, starting where the newest entry ended
+    buffer->entry[buffer->in_offs] = *add_entry;
+    buffer->entry_start[buffer->in_offs] = buffer->end_offset;
+    buffer->end_offset += add_entry->size;
+
+    // Advance in_offs to the next position
+    buffer->in_offs = (buffer->in_offs + 1) & buffer->mask;
+
+    // Check if buffer is now full
+    if (((buffer->in_offs - buffer->out_offs) & buffer->mask) == (buffer->capacity & buffer->mask)) {
+        buffer->full = true;
+    }
+}
+
+/**
+* Describes up to @param len bytes of @param buffer, starting at @param char_offset (as for
+* aesd_circular_buffer_find_entry_offset_for_fpos()), with one @param iov element per entry
+* touched, oldest first.  Empty entries are skipped.  Any necessary locking must be performed
+* by the caller, who must also finish with the described bytes (copy_to_user(), writev(), ...)
+* before an entry covered by them can be evicted and its memory freed.
+* @param iovcnt the number of elements @param iov has room for
+* @param bytes_rtn if not NULL, receives the number of bytes described, which is less than
+*      @param len if the buffer ends first or @param iov fills up; call again from
+*      char_offset + *bytes_rtn for the rest.
+* @return the number of @param iov elements filled
+*/
+unsigned int aesd_circular_buffer_fill_iovec(const struct aesd_circular_buffer *buffer, size_t char_offset,
+            size_t len, struct aesd_iovec *iov, unsigned int iovcnt, size_t *bytes_rtn)
+{
+    unsigned int filled = 0;
+    size_t bytes = 0;
+
+    if (bytes_rtn)
+        *bytes_rtn = 0;
+    if (!buffer || !iov)
+        return 0;
+
+    unsigned int count = aesd_circular_buffer_count(buffer);
+    if (count == 0 || char_offset >= aesd_circular_buffer_total_size(buffer))
+        return 0;
+
+    unsigned int index = aesd_circular_buffer_search(buffer, count, char_offset);
+    unsigned int remaining = count - ((index - buffer->out_offs) & buffer->mask);
+    size_t skip = char_offset - aesd_circular_buffer_entry_pos(buffer, index);
+
+    for (; remaining > 0 && bytes < len && filled < iovcnt; remaining--, index = (index + 1) & buffer->mask) {
+        size_t size = buffer->entry[index].size - skip;
+        if (size == 0)
+            continue;
+        if (size > len - bytes)
+            size = len - bytes;
+        iov[filled].iov_base = (void *)(buffer->entry[index].buffptr + skip);
+        iov[filled].iov_len = size;
+        filled++;
+        bytes += size;
+        skip = 0;
+    }
+    if (bytes_rtn)
+        *bytes_rtn = bytes;
+    return filled;
 }
 
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
-* new start location.
+* new start location.  The byte budget is not applied; use aesd_circular_buffer_add_entry_evict()
+* to get the overwritten entry back or to keep the buffer within its byte budget.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
 */
@@ -69,27 +214,127 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
     if (!buffer || !add_entry)
     return;
 
-    // Add the new entry at the current in_offs position
-    buffer->entry[buffer->in_offs] = *add_entry;
-
     // If buffer is full, advance out_offs as we're overwriting the oldest entry
-    if (buffer->full) {
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    }
+    if (buffer->full)
+        aesd_circular_buffer_pop(buffer, NULL);
+    aesd_circular_buffer_push(buffer, add_entry);
+}
 
-    // Advance in_offs to the next position
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/**
+* Adds entry @param add_entry to @param buffer, first evicting the oldest entries as needed: one if
+* the buffer is full, and as many more as it takes for the total size, including the new entry, to
+* stay within the byte budget set with aesd_circular_buffer_set_byte_budget().
+* Any necessary locking must be handled by the caller.
+* @param evicted_rtn receives the evicted entries, oldest first, so the caller can free their
+*      memory.  May be NULL if the caller does not own the entries' memory.
+* @param max_evicted the number of entries evicted_rtn has room for.  An array of
+*      buffer->capacity entries always suffices.
+* @return the number of entries evicted, or a negative errno leaving @param buffer unchanged:
+*      -EFBIG if @param add_entry alone exceeds the byte budget, -ENOBUFS if more than
+*      @param max_evicted entries would have to be evicted.
+*/
+int aesd_circular_buffer_add_entry_evict(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry,
+            struct aesd_buffer_entry *evicted_rtn, unsigned int max_evicted)
+{
+    if (!buffer || !add_entry)
+        return -EINVAL;
 
-    // Check if buffer is now full
-    if (buffer->in_offs == buffer->out_offs) {
-        buffer->full = true;
+    unsigned int count = aesd_circular_buffer_count(buffer);
+    unsigned int evict = buffer->full ? 1 : 0;
+
+    if (buffer->byte_budget) {
+        if (add_entry->size > buffer->byte_budget)
+            return -EFBIG;
+        // Bytes kept after evicting the oldest evict entries run from that entry's start to the end
+        while (evict < count &&
+               buffer->end_offset - buffer->entry_start[(buffer->out_offs + evict) & buffer->mask] >
+                   buffer->byte_budget - add_entry->size)
+            evict++;
     }
+    if (evicted_rtn && evict > max_evicted)
+        return -ENOBUFS;
+
+    for (unsigned int i = 0; i < evict; i++)
+        aesd_circular_buffer_pop(buffer, evicted_rtn ? &evicted_rtn[i] : NULL);
+    aesd_circular_buffer_push(buffer, add_entry);
+    return evict;
 }
 
 /**
-* Initializes the circular buffer described by @param buffer to an empty struct
+* Limits the total size of the entries kept in @param buffer to @param byte_budget bytes, or
+* removes the limit if it is 0.  Applies from the next aesd_circular_buffer_add_entry_evict().
+*/
+void aesd_circular_buffer_set_byte_budget(struct aesd_circular_buffer *buffer, size_t byte_budget)
+{
+    if (buffer)
+        buffer->byte_budget = byte_budget;
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct holding up to
+* AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries in slots embedded in the struct.
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->entry_storage;
+    buffer->entry_start = buffer->entry_start_storage;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->mask = AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS - 1;
+}
+
+/**
+* Initializes @param buffer to hold up to @param capacity entries, allocating the slots
+* (@param capacity rounded up to a power of two) unless the embedded ones are big enough.
+* Release with aesd_circular_buffer_free().
+* @return 0 on success, -EINVAL for a zero capacity or -ENOMEM if the slots could not be allocated.
+*/
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, unsigned int capacity)
+{
+    unsigned int slots = 1;
+
+    if (!buffer || capacity == 0 || capacity > (~0u >> 1) + 1)
+        return -EINVAL;
+    while (slots < capacity)
+        slots <<= 1;
+
+    aesd_circular_buffer_init(buffer);
+    buffer->capacity = capacity;
+    if (slots <= AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS)
+        return 0;
+
+    // One allocation for both per-slot arrays
+    buffer->entry = aesd_buffer_alloc(slots * (sizeof(*buffer->entry) + sizeof(*buffer->entry_start)));
+    if (!buffer->entry) {
+        aesd_circular_buffer_init(buffer);
+        return -ENOMEM;
+    }
+    buffer->entry_start = (size_t *)(buffer->entry + slots);
+    buffer->mask = slots - 1;
+    return 0;
+}
+
+/**
+* Releases the slots allocated by aesd_circular_buffer_init_capacity(), leaving @param buffer
+* empty with the default capacity.  Memory referenced by the entries is the caller's to free,
+* for instance with AESD_CIRCULAR_BUFFER_FOREACH() beforehand.
+*/
+void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer)
+{
+    if (!buffer)
+        return;
+    if (buffer->entry != buffer->entry_storage)
+        aesd_buffer_release(buffer->entry);
+    aesd_circular_buffer_init(buffer);
+}
+
+/**
+* @return the number of bytes stored in all entries of @param buffer, without walking them.
+* Any necessary locking must be performed by the caller.
+*/
+size_t aesd_circular_buffer_total_size(const struct aesd_circular_buffer *buffer)
+{
+    if (!buffer || aesd_circular_buffer_count(buffer) == 0)
+        return 0;
+    return buffer->end_offset - buffer->entry_start[buffer->out_offs];
 }
@@ -10,13 +10,33 @@
 
 #ifdef __KERNEL__
 #include <linux/types.h>
+#include <linux/uio.h> // struct kvec
+#define aesd_iovec kvec
 #else
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <sys/uio.h> // struct iovec
+#define aesd_iovec iovec
 #endif
 
+/**
+ * Number of entries kept by a buffer set up with aesd_circular_buffer_init().
+ * Buffers set up with aesd_circular_buffer_init_capacity() may hold any number of entries.
+ */
+#ifndef AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+#endif
+
+/**
+ * Slots embedded in struct aesd_circular_buffer for the default capacity.  Slot counts are
+ * always a power of two so that indexes wrap with a mask instead of a division.
+ */
+#define AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS 16
+
+_Static_assert((AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS & (AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS - 1)) == 0 &&
+               AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+               "default slots must be a power of two holding the default capacity");
 
 struct aesd_buffer_entry
 {
@@ -33,39 +53,92 @@ struct aesd_buffer_entry
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations.
+     * Has mask + 1 slots, of which at most capacity hold entries.
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_buffer_entry *entry;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    unsigned int in_offs;
     /**
-     * The first location in the entry structure to read from
+     * The first location in the entry structure to read from.  When the buffer is full this
+     * is the entry the next aesd_circular_buffer_add_entry() evicts.
      */
-    uint8_t out_offs;
+    unsigned int out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Maximum number of entries held before the oldest is evicted
+     */
+    unsigned int capacity;
+    /**
+     * Number of slots minus one; slot indexes wrap with (index & mask)
+     */
+    unsigned int mask;
+    /**
+     * Offset of the first byte of each entry in the stream of every byte ever added, per slot.
+     * These only grow, so evicting an entry never requires updating the others; the
+     * position of entry[i] within the buffer is entry_start[i] - entry_start[out_offs].
+     */
+    size_t *entry_start;
+    /**
+     * Stream offset just past the newest entry, i.e. the entry_start of the next entry added
+     */
+    size_t end_offset;
+    /**
+     * Index of the entry returned by the last lookup, checked first by the next lookup
+     * so that sequential reads are found without a search
+     */
+    unsigned int lookup_hint;
+    /**
+     * Maximum total size of the entries, enforced by aesd_circular_buffer_add_entry_evict();
+     * 0 for no limit
+     */
+    size_t byte_budget;
+    /**
+     * Slots used by aesd_circular_buffer_init(), so the default buffer needs no allocation.
+     * A buffer using them must not be copied by value, since entry points into it.
+     */
+    struct aesd_buffer_entry entry_storage[AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS];
+    size_t entry_start_storage[AESD_CIRCULAR_BUFFER_DEFAULT_SLOTS];
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern unsigned int aesd_circular_buffer_fill_iovec(const struct aesd_circular_buffer *buffer, size_t char_offset,
+            size_t len, struct aesd_iovec *iov, unsigned int iovcnt, size_t *bytes_rtn);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern int aesd_circular_buffer_add_entry_evict(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry,
+            struct aesd_buffer_entry *evicted_rtn, unsigned int max_evicted);
+
+extern void aesd_circular_buffer_set_byte_budget(struct aesd_circular_buffer *buffer, size_t byte_budget);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer, unsigned int capacity);
+
+extern void aesd_circular_buffer_free(struct aesd_circular_buffer *buffer);
+
+extern unsigned int aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+extern size_t aesd_circular_buffer_total_size(const struct aesd_circular_buffer *buffer);
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each member of the circular buffer, oldest first.
+ * Only slots currently holding an entry are visited, so evicted entries are never seen twice.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is an unsigned int stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * unsigned int index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -73,9 +146,9 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  * }
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
-    for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
-            index++, entryptr=&((buffer)->entry[index]))
+    for(index=0, entryptr=&((buffer)->entry[(buffer)->out_offs]); \
+            index<aesd_circular_buffer_count(buffer); \
+            index++, entryptr=&((buffer)->entry[((buffer)->out_offs + index) & (buffer)->mask]))
 
 
 
@@ -0,0 +1,135 @@
+/**
+ * Compares the latency of do_exec() (fork + execv) with do_spawn() (posix_spawn) as the
+ * parent's resident set grows.
+ *
+ * For each size given on the command line (in MiB, default 0 64 256 1024), the parent
+ * allocates and touches that much memory, then runs the command (default /bin/true) the
+ * given number of times each way and reports the mean and median fork-to-exit latency.
+ * fork() copies the parent's page tables, so its cost grows with the resident set, while
+ * posix_spawn() shares the parent's memory until the child execs.  A final batch run
+ * reports the throughput of do_spawn_batch() with several commands in flight.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "systemcalls.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Run @param command @param iterations times with do_exec() or do_spawn() and report the latency
+static int measure(const char *label, bool use_fork, char *command, int iterations, uint64_t *samples)
+{
+    uint64_t total = 0;
+    int failures = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        bool ok = use_fork ? do_exec(1, command) : do_spawn(1, command);
+        samples[i] = now_ns() - start;
+        total += samples[i];
+        failures += !ok;
+    }
+    qsort(samples, iterations, sizeof(*samples), compare_u64);
+    printf("  %-6s mean %8.1f us  p50 %8.1f us  max %8.1f us%s\n", label,
+           total / 1e3 / iterations, samples[iterations / 2] / 1e3, samples[iterations - 1] / 1e3,
+           failures ? "  (command failed)" : "");
+    return failures;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-j batch_in_flight] [-c command] [rss_mib ...]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    static const long default_sizes[] = { 0, 64, 256, 1024 };
+    char *command = "/bin/true";
+    int iterations = 200;
+    unsigned int in_flight = 8;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:j:c:")) != -1) {
+        switch (c) {
+        case 'n':
+            iterations = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'j':
+            in_flight = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            command = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1 || command[0] != '/') {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int nsizes = argc > optind ? argc - optind : (int)(sizeof(default_sizes) / sizeof(default_sizes[0]));
+    uint64_t *samples = malloc(iterations * sizeof(*samples));
+    struct spawn_cmd *batch = malloc(iterations * sizeof(*batch));
+    char *batch_argv[] = { command, NULL };
+    int failures = 0;
+
+    if (!samples || !batch) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    for (int s = 0; s < nsizes; s++) {
+        long mib = argc > optind ? strtol(argv[optind + s], NULL, 10) : default_sizes[s];
+        size_t bytes = (size_t)mib << 20;
+        char *rss = NULL;
+
+        if (mib < 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (bytes) {
+            rss = malloc(bytes);
+            if (!rss) {
+                fprintf(stderr, "Could not allocate %ld MiB\n", mib);
+                return 1;
+            }
+            memset(rss, 1, bytes); // Touch every page so it is resident
+        }
+
+        printf("parent RSS +%ld MiB, %d runs of %s\n", mib, iterations, command);
+        failures += measure("fork", true, command, iterations, samples);
+        failures += measure("spawn", false, command, iterations, samples);
+
+        for (int i = 0; i < iterations; i++)
+            batch[i] = (struct spawn_cmd){ .argv = batch_argv };
+        uint64_t start = now_ns();
+        size_t ok = do_spawn_batch(batch, iterations, in_flight);
+        double elapsed = (now_ns() - start) / 1e9;
+        printf("  batch  %u in flight: %.0f commands/s\n", in_flight, iterations / elapsed);
+        failures += iterations - (int)ok;
+
+        free(rss);
+    }
+
+    free(samples);
+    free(batch);
+    return failures ? 2 : 0;
+}
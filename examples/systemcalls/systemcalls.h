@@ -1,9 +1,29 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <sys/types.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+
+bool do_spawn(int count, ...);
+
+bool do_spawn_redirect(const char *outputfile, int count, ...);
+
+/**
+ * One command for do_spawn_batch().  argv is NULL-terminated with the full path to the
+ * command in argv[0], as for do_exec().  Set outputfile to redirect its stdout, or leave it
+ * NULL.  status receives the wait status, or -1 if the command could not be started.
+ */
+struct spawn_cmd {
+    char *const *argv;
+    const char *outputfile;
+    int status;
+};
+
+size_t do_spawn_batch(struct spawn_cmd *cmds, size_t count, unsigned int max_in_flight);
@@ -2,6 +2,10 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...)
@@ -62,4 +66,507 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+/* ---- thread pool ---- */
+
+struct thread_future {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    thread_task_fn fn;
+    void *arg;
+    void *result;
+    bool done;
+    bool detached;  // Nobody will join: the worker frees the future when the task is done
+};
+
+// A worker's tasks: the owner pushes and pops at the back, thieves steal from the front
+struct pool_deque {
+    pthread_mutex_t lock;
+    struct thread_future **tasks;
+    size_t head;  // Index of the front task
+    size_t count;
+    size_t cap;   // A power of two
+};
+
+struct pool_worker {
+    pthread_t tid;
+    struct pool_deque deque;
+    struct thread_pool *pool;
+    unsigned int index;
+};
+
+// A delayed task, in the timer thread's min-heap ordered by deadline
+struct pool_timer {
+    uint64_t deadline;  // CLOCK_MONOTONIC, in ns
+    struct thread_future *future;
+};
+
+struct thread_pool {
+    struct pool_worker *workers;
+    unsigned int num_workers;
+    atomic_uint next_worker;  // Round robin for tasks submitted from outside the pool
+    atomic_long pending;      // Tasks queued, running or waiting for their timer
+    atomic_long queued;       // Tasks sitting in some deque
+    atomic_int idle;          // Workers sleeping on work_cond
+    bool stop;                // Set under work_mutex once pending has dropped to 0
+    pthread_mutex_t work_mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t drained_cond;  // Signalled when pending drops to 0
+
+    pthread_t timer_tid;
+    pthread_mutex_t timer_mutex;
+    pthread_cond_t timer_cond;    // Uses CLOCK_MONOTONIC
+    struct pool_timer *timers;
+    size_t num_timers;
+    size_t timers_cap;
+    bool timer_stop;
+};
+
+// The worker the calling thread is, if any, so its submissions stay on its own deque
+static __thread struct pool_worker *current_worker;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int deque_push_back(struct pool_deque *dq, struct thread_future *task)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : 64;
+        struct thread_future **tasks = malloc(cap * sizeof(*tasks));
+        if (!tasks) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < dq->count; i++)
+            tasks[i] = dq->tasks[(dq->head + i) & (dq->cap - 1)];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    dq->tasks[(dq->head + dq->count) & (dq->cap - 1)] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static struct thread_future *deque_pop_back(struct pool_deque *dq)
+{
+    struct thread_future *task = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        task = dq->tasks[(dq->head + dq->count) & (dq->cap - 1)];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+static struct thread_future *deque_steal_front(struct pool_deque *dq)
+{
+    struct thread_future *task = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) & (dq->cap - 1);
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return task;
+}
+
+static void future_free(struct thread_future *future)
+{
+    pthread_cond_destroy(&future->cond);
+    pthread_mutex_destroy(&future->lock);
+    free(future);
+}
+
+// Run @param future's task and publish its result; the caller accounts for it in pending
+static void run_task(struct thread_future *future)
+{
+    void *result = future->fn(future->arg);
+
+    pthread_mutex_lock(&future->lock);
+    future->result = result;
+    future->done = true;
+    bool detached = future->detached;
+    pthread_cond_broadcast(&future->cond);
+    pthread_mutex_unlock(&future->lock);
+    if (detached)
+        future_free(future);
+}
+
+static void task_finished(struct thread_pool *pool)
+{
+    if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->work_mutex);
+        pthread_cond_broadcast(&pool->drained_cond);
+        pthread_mutex_unlock(&pool->work_mutex);
+    }
+}
+
+// Queue @param future on the calling worker's deque, or on the next one round robin
+static int enqueue(struct thread_pool *pool, struct thread_future *future)
+{
+    struct pool_worker *w = current_worker;
+
+    if (!w || w->pool != pool)
+        w = &pool->workers[atomic_fetch_add(&pool->next_worker, 1) % pool->num_workers];
+    if (deque_push_back(&w->deque, future) < 0)
+        return -1;
+    atomic_fetch_add(&pool->queued, 1);
+    if (atomic_load(&pool->idle) > 0) {
+        pthread_mutex_lock(&pool->work_mutex);
+        pthread_cond_signal(&pool->work_cond);
+        pthread_mutex_unlock(&pool->work_mutex);
+    }
+    return 0;
+}
+
+// Take a task from the own deque, or else steal one, starting after this worker
+static struct thread_future *next_task(struct pool_worker *w)
+{
+    struct thread_pool *pool = w->pool;
+    struct thread_future *task = deque_pop_back(&w->deque);
+
+    for (unsigned int i = 1; !task && i < pool->num_workers; i++)
+        task = deque_steal_front(&pool->workers[(w->index + i) % pool->num_workers].deque);
+    return task;
+}
+
+static void *pool_worker_thread(void *arg)
+{
+    struct pool_worker *w = arg;
+    struct thread_pool *pool = w->pool;
+
+    current_worker = w;
+    while (1) {
+        struct thread_future *task = next_task(w);
+        if (task) {
+            atomic_fetch_sub(&pool->queued, 1);
+            run_task(task);
+            task_finished(pool);
+            continue;
+        }
+
+        // Sleep until a task is queued somewhere or the pool stops.  enqueue() checks idle
+        // after bumping queued, and we check queued after bumping idle, so no wakeup is lost.
+        pthread_mutex_lock(&pool->work_mutex);
+        atomic_fetch_add(&pool->idle, 1);
+        while (atomic_load(&pool->queued) <= 0 && !pool->stop)
+            pthread_cond_wait(&pool->work_cond, &pool->work_mutex);
+        atomic_fetch_sub(&pool->idle, 1);
+        bool stop = pool->stop && atomic_load(&pool->queued) <= 0;
+        pthread_mutex_unlock(&pool->work_mutex);
+        if (stop)
+            return NULL;
+    }
+}
+
+static void timer_heap_pop(struct thread_pool *pool)
+{
+    struct pool_timer *heap = pool->timers;
+    size_t n = --pool->num_timers;
+    size_t i = 0;
+
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && heap[child + 1].deadline < heap[child].deadline)
+            child++;
+        if (heap[n].deadline <= heap[child].deadline)
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = heap[n];
+}
+
+// @return 0 on success, or -1 if the heap could not grow
+static int timer_heap_push(struct thread_pool *pool, struct pool_timer timer)
+{
+    if (pool->num_timers == pool->timers_cap) {
+        size_t cap = pool->timers_cap ? pool->timers_cap * 2 : 64;
+        struct pool_timer *timers = realloc(pool->timers, cap * sizeof(*timers));
+        if (!timers)
+            return -1;
+        pool->timers = timers;
+        pool->timers_cap = cap;
+    }
+
+    size_t i = pool->num_timers++;
+    while (i > 0 && pool->timers[(i - 1) / 2].deadline > timer.deadline) {
+        pool->timers[i] = pool->timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    pool->timers[i] = timer;
+    return 0;
+}
+
+// Queues each delayed task once it is due, sleeping until the earliest deadline in between
+static void *pool_timer_thread(void *arg)
+{
+    struct thread_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->timer_mutex);
+    while (1) {
+        if (pool->num_timers == 0) {
+            if (pool->timer_stop)
+                break;
+            pthread_cond_wait(&pool->timer_cond, &pool->timer_mutex);
+            continue;
+        }
+
+        uint64_t deadline = pool->timers[0].deadline;
+        if (deadline <= monotonic_ns()) {
+            struct thread_future *future = pool->timers[0].future;
+            timer_heap_pop(pool);
+            pthread_mutex_unlock(&pool->timer_mutex);
+            if (enqueue(pool, future) < 0) {
+                ERROR_LOG("Failed to queue delayed task, running it on the timer thread");
+                run_task(future);
+                task_finished(pool);
+            }
+            pthread_mutex_lock(&pool->timer_mutex);
+            continue;
+        }
+
+        struct timespec ts = { .tv_sec = deadline / 1000000000ull, .tv_nsec = deadline % 1000000000ull };
+        pthread_cond_timedwait(&pool->timer_cond, &pool->timer_mutex, &ts);
+    }
+    pthread_mutex_unlock(&pool->timer_mutex);
+    return NULL;
+}
+
+// Stop and join the first @param started workers and, if @param timer_started, the timer thread
+static void pool_stop(struct thread_pool *pool, unsigned int started, bool timer_started)
+{
+    pthread_mutex_lock(&pool->work_mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->work_mutex);
+    for (unsigned int i = 0; i < started; i++)
+        pthread_join(pool->workers[i].tid, NULL);
+
+    if (timer_started) {
+        pthread_mutex_lock(&pool->timer_mutex);
+        pool->timer_stop = true;
+        pthread_cond_signal(&pool->timer_cond);
+        pthread_mutex_unlock(&pool->timer_mutex);
+        pthread_join(pool->timer_tid, NULL);
+    }
+
+    for (unsigned int i = 0; i < pool->num_workers; i++) {
+        free(pool->workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+    free(pool->workers);
+    free(pool->timers);
+    pthread_cond_destroy(&pool->timer_cond);
+    pthread_mutex_destroy(&pool->timer_mutex);
+    pthread_cond_destroy(&pool->drained_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->work_mutex);
+    free(pool);
+}
+
+struct thread_pool *thread_pool_create(unsigned int num_workers)
+{
+    if (num_workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        ERROR_LOG("Failed to allocate memory for thread_pool");
+        return NULL;
+    }
+    pool->workers = calloc(num_workers, sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        ERROR_LOG("Failed to allocate memory for thread_pool workers");
+        free(pool);
+        return NULL;
+    }
+    pool->num_workers = num_workers;
+    pthread_mutex_init(&pool->work_mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->drained_cond, NULL);
+    pthread_mutex_init(&pool->timer_mutex, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    for (unsigned int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    if (pthread_create(&pool->timer_tid, NULL, pool_timer_thread, pool) != 0) {
+        ERROR_LOG("Failed to create timer thread");
+        pool_stop(pool, 0, false);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < num_workers; i++) {
+        if (pthread_create(&pool->workers[i].tid, NULL, pool_worker_thread, &pool->workers[i]) != 0) {
+            ERROR_LOG("Failed to create worker thread %u", i);
+            pool_stop(pool, i, true);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->work_mutex);
+    while (atomic_load(&pool->pending) > 0)
+        pthread_cond_wait(&pool->drained_cond, &pool->work_mutex);
+    pthread_mutex_unlock(&pool->work_mutex);
+    pool_stop(pool, pool->num_workers, true);
+}
+
+static struct thread_future *future_create(thread_task_fn fn, void *arg)
+{
+    struct thread_future *future = calloc(1, sizeof(*future));
+    if (future == NULL) {
+        ERROR_LOG("Failed to allocate memory for thread_future");
+        return NULL;
+    }
+    pthread_mutex_init(&future->lock, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    future->fn = fn;
+    future->arg = arg;
+    return future;
+}
+
+struct thread_future *thread_pool_submit(struct thread_pool *pool, thread_task_fn fn, void *arg)
+{
+    struct thread_future *future = future_create(fn, arg);
+    if (future == NULL)
+        return NULL;
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (enqueue(pool, future) < 0) {
+        ERROR_LOG("Failed to queue task");
+        task_finished(pool);
+        future_free(future);
+        return NULL;
+    }
+    return future;
+}
+
+struct thread_future *thread_pool_submit_after(struct thread_pool *pool, unsigned int delay_ms,
+        thread_task_fn fn, void *arg)
+{
+    if (delay_ms == 0)
+        return thread_pool_submit(pool, fn, arg);
+
+    struct thread_future *future = future_create(fn, arg);
+    if (future == NULL)
+        return NULL;
+
+    struct pool_timer timer = { .deadline = monotonic_ns() + delay_ms * 1000000ull, .future = future };
+    atomic_fetch_add(&pool->pending, 1);
+    pthread_mutex_lock(&pool->timer_mutex);
+    int rc = timer_heap_push(pool, timer);
+    // Wake the timer thread only if its earliest deadline moved
+    if (rc == 0 && pool->timers[0].future == future)
+        pthread_cond_signal(&pool->timer_cond);
+    pthread_mutex_unlock(&pool->timer_mutex);
+    if (rc < 0) {
+        ERROR_LOG("Failed to schedule delayed task");
+        task_finished(pool);
+        future_free(future);
+        return NULL;
+    }
+    return future;
+}
+
+bool thread_future_done(struct thread_future *future)
+{
+    pthread_mutex_lock(&future->lock);
+    bool done = future->done;
+    pthread_mutex_unlock(&future->lock);
+    return done;
+}
+
+void *thread_future_join(struct thread_future *future)
+{
+    pthread_mutex_lock(&future->lock);
+    while (!future->done)
+        pthread_cond_wait(&future->cond, &future->lock);
+    void *result = future->result;
+    pthread_mutex_unlock(&future->lock);
+    future_free(future);
+    return result;
+}
+
+void thread_future_detach(struct thread_future *future)
+{
+    pthread_mutex_lock(&future->lock);
+    bool done = future->done;
+    future->detached = true;
+    pthread_mutex_unlock(&future->lock);
+    if (done)
+        future_free(future);
+}
+
+// Task of start_task_obtaining_mutex(): the delay before obtaining the mutex was its timer
+static void *mutex_task(void *arg)
+{
+    struct thread_data* thread_func_args = (struct thread_data *) arg;
+    pthread_mutex_t *mutex = thread_func_args->mutex;
+    int wait_to_release_ms = thread_func_args->wait_to_release_ms;
+    free(thread_func_args);
+
+    if (pthread_mutex_lock(mutex) != 0) {
+        ERROR_LOG("Failed to lock mutex");
+        return NULL;
+    }
+
+    // Holding the mutex is the point of the task, so this wait stays on the worker
+    usleep(wait_to_release_ms * 1000);
+
+    if (pthread_mutex_unlock(mutex) != 0) {
+        ERROR_LOG("Failed to unlock mutex");
+        return NULL;
+    }
+    return mutex;
+}
+
+bool start_task_obtaining_mutex(struct thread_pool *pool, struct thread_future **future,
+        pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    struct thread_data* thread_data = (struct thread_data*) malloc(sizeof(struct thread_data));
+    if (thread_data == NULL) {
+        ERROR_LOG("Failed to allocate memory for thread_data");
+        return false;
+    }
+    thread_data->mutex = mutex;
+    thread_data->wait_to_obtain_ms = wait_to_obtain_ms;
+    thread_data->wait_to_release_ms = wait_to_release_ms;
+    thread_data->thread_complete_success = false;
+
+    *future = thread_pool_submit_after(pool, wait_to_obtain_ms > 0 ? wait_to_obtain_ms : 0,
+                                       mutex_task, thread_data);
+    if (*future == NULL) {
+        free(thread_data);
+        return false;
+    }
+    return true;
+}
@@ -42,3 +42,79 @@ struct thread_data{
 * @return true if the thread could be started, false if a failure occurred.
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
+
+
+/**
+* A task run by a thread_pool: called with the arg it was submitted with, its return value
+* becomes the result of its thread_future.
+*/
+typedef void *(*thread_task_fn)(void *arg);
+
+/**
+* A fixed set of worker threads that run submitted tasks, so that short tasks do not pay for
+* creating and joining a thread each.  Each worker has its own deque of tasks: tasks submitted
+* from a worker go to the back of its own deque and it runs them newest first, while tasks
+* submitted from other threads are spread over the workers round robin.  A worker whose deque
+* is empty steals the oldest task of another worker before going to sleep.
+* Delayed tasks are held by a timer thread until they are due, instead of occupying a worker.
+*/
+struct thread_pool;
+
+/**
+* The handle of one submitted task, used to wait for its result.  Each future must be
+* released exactly once, with either thread_future_join() or thread_future_detach().
+*/
+struct thread_future;
+
+/**
+* @param num_workers the number of worker threads, 0 for one per online CPU
+* @return the new pool, or NULL if it could not be created.
+*/
+struct thread_pool *thread_pool_create(unsigned int num_workers);
+
+/**
+* Waits for every task submitted to @param pool to finish, including delayed tasks that are not
+* due yet, then stops its threads and frees it.  Futures stay valid until they are released.
+*/
+void thread_pool_destroy(struct thread_pool *pool);
+
+/**
+* Queues @param fn to be called with @param arg on a worker of @param pool.
+* @return the task's future, or NULL if it could not be queued.
+*/
+struct thread_future *thread_pool_submit(struct thread_pool *pool, thread_task_fn fn, void *arg);
+
+/**
+* Same as thread_pool_submit(), but the task is queued only once @param delay_ms milliseconds
+* have passed.
+*/
+struct thread_future *thread_pool_submit_after(struct thread_pool *pool, unsigned int delay_ms,
+        thread_task_fn fn, void *arg);
+
+/**
+* @return true if the task of @param future has finished, so thread_future_join() will not block.
+*/
+bool thread_future_done(struct thread_future *future);
+
+/**
+* Waits for the task of @param future to finish and releases the future.  A task that joins
+* another task of its own pool keeps its worker blocked meanwhile.
+* @return the value the task returned.
+*/
+void *thread_future_join(struct thread_future *future);
+
+/**
+* Releases @param future without waiting: the task still runs, and its result is dropped.
+*/
+void thread_future_detach(struct thread_future *future);
+
+/**
+* Pool counterpart of start_thread_obtaining_mutex(): the task is submitted to @param pool to
+* run after @param wait_to_obtain_ms, obtains @param mutex, holds it for
+* @param wait_to_release_ms milliseconds and releases it.  No thread waits out the delay
+* before the mutex is obtained.  On success @param future is filled with the task's future,
+* whose result is @param mutex if the mutex was obtained and released, or NULL on failure.
+* @return true if the task could be submitted, false if a failure occurred.
+*/
+bool start_task_obtaining_mutex(struct thread_pool *pool, struct thread_future **future,
+        pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms);
@@ -39,9 +39,8 @@ if [ $assignment != 'assignment1' ]; then
     fi
 fi
 
-for i in $(seq 1 $NUMFILES); do
-    writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"  # Remove ./
-done
+# Create ${username}1.txt .. ${username}${NUMFILES}.txt in one writer process
+writer -n "$NUMFILES" -p "${username}%d.txt" -d "$WRITEDIR" "$WRITESTR"
 
 OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")  # Remove ./
 
@@ -0,0 +1,653 @@
+/**
+ * Native replacement for finder.sh: prints the number of regular files under a directory
+ * and the number of lines in them matching a search string, in exactly the format (and
+ * with the same counts) as the script's "find | wc -l" and "grep -r | wc -l".
+ *
+ * The tree is walked once by a pool of worker threads (FINDER_THREADS, default one per
+ * online CPU).  Each worker keeps its own deque of directories and files to visit: it
+ * pushes and pops at the back, so it walks depth-first, and an idle worker steals from
+ * the front of another worker's deque, taking the oldest (usually largest) subtrees.
+ * Files are mapped with mmap() and searched in place; a plain search string is found with
+ * an SSE2/AVX2 first-and-last-byte filter, anything with regex syntax with regexec().
+ *
+ * To match grep's counts, and not just its matching rules:
+ *  - the search string is a basic regular expression, and a newline in it separates
+ *    several patterns, any of which may match
+ *  - a file holding a NUL byte is binary: grep stops printing lines at the read buffer
+ *    holding the first NUL (see GREP_BUFSIZE), and reports the match on stderr instead
+ *  - in a UTF-8 locale, matching lines that are not valid UTF-8 are not printed either
+ *  - a file or directory name holding a newline adds a line to the output of find and grep
+ *  - the starting directory is searched by grep even when it is a symbolic link, but find
+ *    (without -L) then reports no files under it
+ */
+#define _GNU_SOURCE // memrchr, REG_STARTEND
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <pthread.h>
+#include <regex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FINDER_X86 1
+#endif
+
+/**
+ * Size of the reads GNU grep (3.x) scans files in.  It checks each buffer for NUL bytes
+ * before printing any line of it, so the lines printed from a binary file are the complete
+ * lines before the buffer holding its first NUL.
+ */
+#define GREP_BUFSIZE 98304
+
+#define READ_CHUNK 65536 // Growth step when reading files that cannot be mapped
+
+// One directory or file to visit
+struct task {
+    char *path;
+    bool is_dir;
+};
+
+// A worker's tasks: the owner pushes and pops at the back, thieves steal from the front
+struct deque {
+    pthread_mutex_t lock;
+    struct task *tasks;
+    size_t head;  // Index of the front task
+    size_t count;
+    size_t cap;   // A power of two
+};
+
+struct worker {
+    pthread_t tid;
+    struct deque deque;
+    unsigned int index;
+    unsigned long files;  // Lines find would print
+    unsigned long lines;  // Lines grep would print
+};
+
+// One newline-separated part of the search string
+struct pattern {
+    const char *text;
+    size_t len;
+    bool is_regex;
+    regex_t regex;
+};
+
+static struct worker *workers;
+static unsigned int num_workers;
+static struct pattern *patterns;
+static size_t num_patterns;
+static bool count_files = true; // false when the starting point is a symlink, as for find -P
+static bool utf8_locale;
+
+static atomic_long pending;  // Tasks queued or running; the walk is over when it drops to 0
+static atomic_long queued;   // Tasks sitting in some deque
+static atomic_int idle;      // Workers sleeping on work_cond
+static pthread_mutex_t work_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+
+static size_t count_newlines(const char *s)
+{
+    size_t n = 0;
+    while ((s = strchr(s, '\n')) != NULL) {
+        n++;
+        s++;
+    }
+    return n;
+}
+
+/* ---- substring search ---- */
+
+static const char *search_scalar(const char *hay, size_t len, const char *needle, size_t n)
+{
+    return memmem(hay, len, needle, n);
+}
+
+#ifdef FINDER_X86
+
+/**
+ * Both vector searches compare the needle's first byte against 16 or 32 consecutive
+ * positions and its last byte against the positions n - 1 further on, and only check the
+ * whole needle with memcmp() where both match.  The tail is left to memmem().
+ */
+__attribute__((target("sse2")))
+static const char *search_sse2(const char *hay, size_t len, const char *needle, size_t n)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + n - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(hay + pos + 1, needle + 1, n - 2) == 0)
+                return hay + pos;
+            mask &= mask - 1;
+        }
+    }
+    return i < len ? memmem(hay + i, len - i, needle, n) : NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *search_avx2(const char *hay, size_t len, const char *needle, size_t n)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+
+    for (; i + n - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(hay + i + n - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if (memcmp(hay + pos + 1, needle + 1, n - 2) == 0)
+                return hay + pos;
+            mask &= mask - 1;
+        }
+    }
+    return i < len ? memmem(hay + i, len - i, needle, n) : NULL;
+}
+
+#endif /* FINDER_X86 */
+
+static const char *(*search_wide)(const char *hay, size_t len, const char *needle, size_t n) =
+    search_scalar;
+
+static void search_select(void)
+{
+#ifdef FINDER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        search_wide = search_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        search_wide = search_sse2;
+#endif
+}
+
+/**
+ * @return the offset of the first match of @param pat in @param buf[@param from, @param end)
+ * (which starts a line and ends with a newline or the end of the data), or -1.  A regex
+ * match is always within a single line; its offset is where it starts.
+ */
+static long pattern_find(const struct pattern *pat, const char *buf, size_t from, size_t end)
+{
+    if (from >= end)
+        return -1;
+    if (pat->is_regex) {
+        regmatch_t m = { .rm_so = from, .rm_eo = end };
+        if (regexec(&pat->regex, buf, 1, &m, REG_STARTEND) != 0)
+            return -1;
+        return m.rm_so;
+    }
+    if (pat->len == 0)
+        return from;
+
+    const char *hit;
+    if (pat->len == 1)
+        hit = memchr(buf + from, pat->text[0], end - from);
+    else
+        hit = search_wide(buf + from, end - from, pat->text, pat->len);
+    return hit ? hit - buf : -1;
+}
+
+/* ---- line counting ---- */
+
+static bool utf8_valid(const unsigned char *s, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len) {
+        unsigned char c = s[i];
+        size_t n;
+        uint32_t cp;
+        if (c < 0x80) {
+            i++;
+            continue;
+        } else if (c >= 0xc2 && c <= 0xdf) {
+            n = 1;
+            cp = c & 0x1f;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            n = 2;
+            cp = c & 0x0f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+            cp = c & 0x07;
+        } else {
+            return false;
+        }
+        if (len - i <= n)
+            return false;
+        for (size_t k = 1; k <= n; k++) {
+            if ((s[i + k] & 0xc0) != 0x80)
+                return false;
+            cp = cp << 6 | (s[i + k] & 0x3f);
+        }
+        // Overlong forms, surrogates and values past U+10FFFF
+        if ((n == 2 && cp < 0x800) || (n == 3 && (cp < 0x10000 || cp > 0x10ffff)) ||
+            (cp >= 0xd800 && cp <= 0xdfff))
+            return false;
+        i += n + 1;
+    }
+    return true;
+}
+
+/**
+ * Count the lines of @param buf[0, @param len) that grep would print for any pattern, each
+ * printed as @param path_lines + 1 output lines.  Every pattern remembers where it next
+ * matches, so each is searched forward through the data only once.
+ */
+static unsigned long count_matching_lines(const char *buf, size_t len, size_t path_lines)
+{
+    long next[num_patterns];
+    size_t pos = 0;
+    unsigned long lines = 0;
+
+    for (size_t p = 0; p < num_patterns; p++)
+        next[p] = pattern_find(&patterns[p], buf, 0, len);
+
+    while (pos < len) {
+        long hit = -1;
+        for (size_t p = 0; p < num_patterns; p++) {
+            if (next[p] >= 0 && (size_t)next[p] < pos)
+                next[p] = pattern_find(&patterns[p], buf, pos, len);
+            if (next[p] >= 0 && (hit < 0 || next[p] < hit))
+                hit = next[p];
+        }
+        if (hit < 0)
+            break;
+
+        const char *prev = hit > (long)pos ? memrchr(buf + pos, '\n', hit - pos) : NULL;
+        size_t line = prev ? (size_t)(prev - buf) + 1 : pos;
+        const char *newline = memchr(buf + hit, '\n', len - hit);
+        size_t line_end = newline ? (size_t)(newline - buf) : len;
+
+        if (!utf8_locale || utf8_valid((const unsigned char *)buf + line, line_end - line))
+            lines += 1 + path_lines;
+        pos = line_end + 1;
+    }
+    return lines;
+}
+
+// @return the bytes of @param buf grep prints lines from: all of them unless it holds a NUL
+static size_t text_length(const char *buf, size_t len)
+{
+    const char *nul = memchr(buf, '\0', len);
+    if (!nul)
+        return len;
+
+    // Only the complete lines before the grep buffer holding the NUL
+    size_t cut = (size_t)(nul - buf) / GREP_BUFSIZE * GREP_BUFSIZE;
+    const char *newline = cut ? memrchr(buf, '\n', cut) : NULL;
+    return newline ? (size_t)(newline - buf) + 1 : 0;
+}
+
+// Read all of @param fd for files mmap() cannot map, such as those reporting a size of 0
+static char *read_all(int fd, size_t *len)
+{
+    char *buf = NULL;
+    size_t cap = 0, used = 0;
+
+    while (1) {
+        if (used == cap) {
+            char *grown = realloc(buf, cap + READ_CHUNK);
+            if (!grown) {
+                free(buf);
+                errno = ENOMEM;
+                return NULL;
+            }
+            buf = grown;
+            cap += READ_CHUNK;
+        }
+        ssize_t n = read(fd, buf + used, cap - used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buf);
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        used += n;
+    }
+    *len = used;
+    return buf;
+}
+
+static void search_file(struct worker *w, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    char *buf = NULL;
+    size_t len = 0;
+    bool mapped = false;
+    if (st.st_size > 0) {
+        buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED) {
+            mapped = true;
+            len = st.st_size;
+            madvise(buf, len, MADV_SEQUENTIAL);
+        } else {
+            buf = NULL;
+        }
+    }
+    if (!mapped)
+        buf = read_all(fd, &len);
+    close(fd);
+    if (!buf) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    size_t text = text_length(buf, len);
+    if (text > 0)
+        w->lines += count_matching_lines(buf, text, count_newlines(path));
+
+    if (mapped)
+        munmap(buf, len);
+    else
+        free(buf);
+}
+
+/* ---- work-stealing pool ---- */
+
+static int deque_push_back(struct deque *dq, struct task task)
+{
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap * 2 : 64;
+        struct task *tasks = malloc(cap * sizeof(*tasks));
+        if (!tasks) {
+            pthread_mutex_unlock(&dq->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < dq->count; i++)
+            tasks[i] = dq->tasks[(dq->head + i) & (dq->cap - 1)];
+        free(dq->tasks);
+        dq->tasks = tasks;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    dq->tasks[(dq->head + dq->count) & (dq->cap - 1)] = task;
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 0;
+}
+
+static bool deque_pop_back(struct deque *dq, struct task *task)
+{
+    bool ok = false;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        *task = dq->tasks[(dq->head + dq->count) & (dq->cap - 1)];
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+static bool deque_steal_front(struct deque *dq, struct task *task)
+{
+    bool ok = false;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        *task = dq->tasks[dq->head];
+        dq->head = (dq->head + 1) & (dq->cap - 1);
+        dq->count--;
+        ok = true;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+// Queue @param path on @param w's deque, waking an idle worker to steal it
+static void submit(struct worker *w, char *path, bool is_dir)
+{
+    struct task task = { .path = path, .is_dir = is_dir };
+
+    atomic_fetch_add(&pending, 1);
+    if (deque_push_back(&w->deque, task) < 0) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(ENOMEM));
+        free(path);
+        atomic_fetch_sub(&pending, 1);
+        return;
+    }
+    atomic_fetch_add(&queued, 1);
+    if (atomic_load(&idle) > 0) {
+        pthread_mutex_lock(&work_mutex);
+        pthread_cond_signal(&work_cond);
+        pthread_mutex_unlock(&work_mutex);
+    }
+}
+
+static void scan_dir(struct worker *w, const char *path)
+{
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    struct dirent *ent;
+    while ((errno = 0, ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir), ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG)
+            continue; // find -type f and grep -r both skip symlinks, devices, FIFOs, sockets
+
+        size_t name_len = strlen(ent->d_name);
+        char *child = malloc(path_len + name_len + 2);
+        if (!child) {
+            fprintf(stderr, "finder: %s: %s\n", path, strerror(ENOMEM));
+            break;
+        }
+        memcpy(child, path, path_len);
+        child[path_len] = '/';
+        memcpy(child + path_len + 1, ent->d_name, name_len + 1);
+
+        if (type == DT_REG && count_files)
+            w->files += 1 + count_newlines(child);
+        submit(w, child, type == DT_DIR);
+    }
+    if (errno != 0)
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+    closedir(dir);
+}
+
+// Take a task from the own deque, or else steal one, starting after this worker
+static bool next_task(struct worker *w, struct task *task)
+{
+    if (deque_pop_back(&w->deque, task))
+        return true;
+    for (unsigned int i = 1; i < num_workers; i++) {
+        if (deque_steal_front(&workers[(w->index + i) % num_workers].deque, task))
+            return true;
+    }
+    return false;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct task task;
+
+    while (1) {
+        if (next_task(w, &task)) {
+            atomic_fetch_sub(&queued, 1);
+            if (task.is_dir)
+                scan_dir(w, task.path);
+            else
+                search_file(w, task.path);
+            free(task.path);
+            if (atomic_fetch_sub(&pending, 1) == 1) {
+                // That was the last task: wake everyone to exit
+                pthread_mutex_lock(&work_mutex);
+                pthread_cond_broadcast(&work_cond);
+                pthread_mutex_unlock(&work_mutex);
+            }
+            continue;
+        }
+
+        // Sleep until a task is queued somewhere or the walk is over.  submit() checks idle
+        // after bumping queued, and we check queued after bumping idle, so no wakeup is lost.
+        pthread_mutex_lock(&work_mutex);
+        atomic_fetch_add(&idle, 1);
+        while (atomic_load(&queued) == 0 && atomic_load(&pending) > 0)
+            pthread_cond_wait(&work_cond, &work_mutex);
+        atomic_fetch_sub(&idle, 1);
+        bool done = atomic_load(&pending) == 0;
+        pthread_mutex_unlock(&work_mutex);
+        if (done)
+            return NULL;
+    }
+}
+
+/* ---- setup ---- */
+
+// Split @param searchstr into its newline-separated patterns, compiling those that need regex
+static int patterns_init(const char *searchstr)
+{
+    num_patterns = count_newlines(searchstr) + 1;
+    patterns = calloc(num_patterns, sizeof(*patterns));
+    if (!patterns)
+        return -1;
+
+    const char *text = searchstr;
+    for (size_t p = 0; p < num_patterns; p++) {
+        const char *end = strchr(text, '\n');
+        size_t len = end ? (size_t)(end - text) : strlen(text);
+        struct pattern *pat = &patterns[p];
+        pat->text = text;
+        pat->len = len;
+        // Plain text matches itself; everything else goes to the regex engine, as in grep
+        for (size_t i = 0; i < len; i++) {
+            if (strchr("\\.[*^$", text[i])) {
+                pat->is_regex = true;
+                break;
+            }
+        }
+        if (pat->is_regex) {
+            char *re = strndup(text, len);
+            if (!re)
+                return -1;
+            int rc = regcomp(&pat->regex, re, REG_NEWLINE);
+            if (rc != 0) {
+                char msg[256];
+                regerror(rc, &pat->regex, msg, sizeof(msg));
+                fprintf(stderr, "finder: %s\n", msg);
+                free(re);
+                return -1;
+            }
+            free(re);
+        }
+        text += len + 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        printf("Error: Invalid number of arguments\n");
+        printf("Usage: %s filesdir searchstr\n", argv[0]);
+        return 1;
+    }
+
+    const char *filesdir = argv[1];
+    const char *searchstr = argv[2];
+    struct stat st;
+
+    if (stat(filesdir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        printf("Error: Directory %s does not exist\n", filesdir);
+        return 1;
+    }
+    if (lstat(filesdir, &st) == 0 && S_ISLNK(st.st_mode))
+        count_files = false;
+
+    setlocale(LC_ALL, "");
+    utf8_locale = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+    search_select();
+    if (patterns_init(searchstr) < 0)
+        return 2;
+
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *env = getenv("FINDER_THREADS");
+    num_workers = env ? (unsigned int)strtoul(env, NULL, 10) : nprocs > 0 ? (unsigned int)nprocs : 1;
+    if (num_workers < 1)
+        num_workers = 1;
+    workers = calloc(num_workers, sizeof(*workers));
+    char *root = strdup(filesdir);
+    if (!workers || !root) {
+        fprintf(stderr, "finder: %s\n", strerror(ENOMEM));
+        return 2;
+    }
+    for (unsigned int i = 0; i < num_workers; i++) {
+        workers[i].index = i;
+        pthread_mutex_init(&workers[i].deque.lock, NULL);
+    }
+
+    // The root directory goes to the first worker; the others start out stealing
+    submit(&workers[0], root, true);
+    unsigned int started;
+    for (started = 0; started < num_workers; started++) {
+        if (pthread_create(&workers[started].tid, NULL, worker_thread, &workers[started]) != 0)
+            break;
+    }
+    if (started == 0) {
+        fprintf(stderr, "finder: failed to create worker threads\n");
+        return 2;
+    }
+
+    unsigned long files = 0, lines = 0;
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i].tid, NULL);
+        files += workers[i].files;
+        lines += workers[i].lines;
+        free(workers[i].deque.tasks);
+        pthread_mutex_destroy(&workers[i].deque.lock);
+    }
+    for (size_t p = 0; p < num_patterns; p++) {
+        if (patterns[p].is_regex)
+            regfree(&patterns[p].regex);
+    }
+    free(patterns);
+    free(workers);
+
+    printf("The number of files are %lu and the number of matching lines are %lu\n", files, lines);
+    return 0;
+}
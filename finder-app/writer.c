@@ -1,12 +1,402 @@
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DIRECT_ALIGN 4096 // Buffer and length alignment for O_DIRECT writes
+
+// One file to create and what to write into it
+struct job {
+    const char *path;
+    const char *data;
+    size_t len;
+};
+
+// Batch mode settings (see usage())
+struct batch {
+    int dirfd;              // Relative paths are opened against this directory
+    bool manifest;          // -m, jobs come from stdin
+    long count;             // -n, number of files to generate
+    const char *pattern;    // -p, printf pattern with one %d for generated file names
+    long first;             // -i, number of the first generated file
+    const char *payload;    // Written to every generated file
+    size_t payload_len;
+    bool direct;            // -D, O_DIRECT for the aligned part of each payload
+    int threads;            // -j
+    struct job *jobs;       // Manifest entries
+    size_t num_jobs;
+};
+
+// A writer thread's share of the files and its results
+struct batch_worker {
+    pthread_t tid;
+    bool started;           // Running on tid, to be joined
+    struct batch *batch;
+    long begin;
+    long end;
+    unsigned long files;
+    unsigned long bytes;
+    unsigned long failed;
+};
+
+static bool direct_fallback_logged;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <file> <string>\n"
+                    "       %s -m [-d dir] [-D] [-j threads] < manifest\n"
+                    "       %s -n count -p name_pattern [-i first] [-d dir] [-D] [-j threads]\n"
+                    "          (<string> | -P payload_file)\n"
+                    "A manifest line is <file><TAB><string>; name_pattern holds one %%d, e.g. user%%d.txt.\n"
+                    "Like the single-file form, each <string> is written followed by a newline;\n"
+                    "a payload file is written as is.\n",
+            prog, prog, prog);
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Create (truncating) @param path relative to @param dirfd and write @param len bytes into it
+ * with plain write() calls.  With @param direct the block-aligned part of the data, which
+ * must then sit in a DIRECT_ALIGN-aligned buffer, bypasses the page cache.
+ * @return 0 on success, -1 with errno set.
+ */
+static int write_file(int dirfd, const char *path, const char *data, size_t len, bool direct) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    size_t aligned = direct ? len / DIRECT_ALIGN * DIRECT_ALIGN : 0;
+    int fd = -1;
+
+    if (aligned > 0) {
+        fd = openat(dirfd, path, flags | O_DIRECT, 0666);
+        if (fd == -1 && errno == EINVAL) {
+            // Some file systems (tmpfs) refuse O_DIRECT: write through the page cache
+            if (!__atomic_exchange_n(&direct_fallback_logged, true, __ATOMIC_RELAXED))
+                syslog(LOG_WARNING, "O_DIRECT not supported for %s, using buffered writes", path);
+            aligned = 0;
+        } else if (fd != -1) {
+            if (write_all(fd, data, aligned) < 0 ||
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT) == -1) {
+                int saved = errno;
+                close(fd);
+                errno = saved;
+                return -1;
+            }
+        }
+    }
+    if (fd == -1) {
+        fd = openat(dirfd, path, flags, 0666);
+        if (fd == -1)
+            return -1;
+    }
+
+    if (write_all(fd, data + aligned, len - aligned) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return close(fd);
+}
+
+static void *batch_thread(void *arg) {
+    struct batch_worker *w = arg;
+    struct batch *b = w->batch;
+    char name[4096];
+
+    for (long i = w->begin; i < w->end; i++) {
+        struct job job;
+        if (b->manifest) {
+            job = b->jobs[i];
+        } else {
+            snprintf(name, sizeof(name), b->pattern, (int)(b->first + i)); // In range, see batch_main()
+            job = (struct job) { .path = name, .data = b->payload, .len = b->payload_len };
+        }
+        if (write_file(b->dirfd, job.path, job.data, job.len, b->direct) < 0) {
+            syslog(LOG_ERR, "Failed to write file: %s: %s", job.path, strerror(errno));
+            fprintf(stderr, "Error: %s: %s\n", job.path, strerror(errno));
+            w->failed++;
+            continue;
+        }
+        w->files++;
+        w->bytes += job.len;
+    }
+    return NULL;
+}
+
+// @return a copy of @param str followed by a newline, aligned for O_DIRECT
+static char *make_payload(const char *str, size_t len, size_t *payload_len) {
+    char *buf;
+
+    if (posix_memalign((void **)&buf, DIRECT_ALIGN, len + 1) != 0)
+        return NULL;
+    memcpy(buf, str, len);
+    buf[len] = '\n';
+    *payload_len = len + 1;
+    return buf;
+}
+
+// Read "<file>\t<string>" lines from stdin into b->jobs, one payload buffer per line
+static int read_manifest(struct batch *b) {
+    char *line = NULL;
+    size_t line_cap = 0, cap = 0;
+    ssize_t n;
+    long lineno = 0;
+
+    while ((n = getline(&line, &line_cap, stdin)) != -1) {
+        lineno++;
+        if (n > 0 && line[n - 1] == '\n')
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        char *tab = strchr(line, '\t');
+        if (!tab || tab == line) {
+            fprintf(stderr, "Error: manifest line %ld: expected <file><TAB><string>\n", lineno);
+            free(line);
+            return -1;
+        }
+        if (b->num_jobs == cap) {
+            cap = cap ? cap * 2 : 1024;
+            struct job *jobs = realloc(b->jobs, cap * sizeof(*jobs));
+            if (!jobs)
+                goto nomem;
+            b->jobs = jobs;
+        }
+        struct job *job = &b->jobs[b->num_jobs];
+        job->path = strndup(line, tab - line);
+        job->data = make_payload(tab + 1, line + n - (tab + 1), &job->len);
+        if (!job->path || !job->data) {
+            free((char *)job->path);
+            free((char *)job->data);
+            goto nomem;
+        }
+        b->num_jobs++;
+    }
+    free(line);
+    return 0;
+
+nomem:
+    fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+    free(line);
+    return -1;
+}
+
+// Map @param path as the payload of every generated file, which gets its contents as is
+static int load_payload(struct batch *b, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    b->payload_len = st.st_size;
+    if (b->payload_len == 0) {
+        b->payload = "";
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, b->payload_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    b->payload = map; // Page aligned, as O_DIRECT needs
+    return 0;
+}
+
+static int run_batch(struct batch *b) {
+    long total = b->manifest ? (long)b->num_jobs : b->count;
+    int threads = b->threads < total ? b->threads : (total > 0 ? (int)total : 1);
+    struct batch_worker *workers = calloc(threads, sizeof(*workers));
+    struct timespec start, end;
+
+    if (!workers) {
+        fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int t = 0; t < threads; t++) {
+        workers[t].batch = b;
+        workers[t].begin = total * t / threads;
+        workers[t].end = total * (t + 1) / threads;
+        if (threads > 1 && pthread_create(&workers[t].tid, NULL, batch_thread, &workers[t]) == 0)
+            workers[t].started = true;
+        else
+            batch_thread(&workers[t]); // Single-threaded, or out of threads: run it here
+    }
+    for (int t = 0; t < threads; t++) {
+        if (workers[t].started)
+            pthread_join(workers[t].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long files = 0, bytes = 0, failed = 0;
+    for (int t = 0; t < threads; t++) {
+        files += workers[t].files;
+        bytes += workers[t].bytes;
+        failed += workers[t].failed;
+    }
+    free(workers);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double rate = elapsed > 0 ? files / elapsed : 0;
+    syslog(LOG_DEBUG, "Wrote %lu files (%lu bytes), %lu failed, in %.3f s", files, bytes, failed, elapsed);
+    printf("Wrote %lu files (%lu bytes) in %.3f s: %.0f files/s, %.1f MiB/s\n", files, bytes, elapsed,
+           rate, elapsed > 0 ? bytes / elapsed / (1 << 20) : 0);
+    if (failed) {
+        printf("%lu files failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
+
+// @return true if @param pattern holds exactly one conversion, and that is an int (%d, %05d, ...)
+static bool valid_pattern(const char *pattern) {
+    int conversions = 0;
+
+    for (const char *p = strchr(pattern, '%'); p; p = strchr(p, '%')) {
+        p++;
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+        p += strspn(p, "0-+ ");
+        p += strspn(p, "0123456789");
+        if (*p != 'd')
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+static int batch_main(int argc, char *argv[]) {
+    struct batch b = { .dirfd = AT_FDCWD, .count = -1, .first = 1, .threads = 1 };
+    const char *dir = NULL, *payload_file = NULL;
+    int c;
+
+    while ((c = getopt(argc, argv, "md:n:p:i:P:Dj:")) != -1) {
+        switch (c) {
+        case 'm':
+            b.manifest = true;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'n':
+            b.count = strtol(optarg, NULL, 10);
+            break;
+        case 'p':
+            b.pattern = optarg;
+            break;
+        case 'i':
+            b.first = strtol(optarg, NULL, 10);
+            break;
+        case 'P':
+            payload_file = optarg;
+            break;
+        case 'D':
+            b.direct = true;
+            break;
+        case 'j':
+            b.threads = (int)strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Either a manifest, or a count and pattern with exactly one source for the payload
+    bool generate = b.count >= 0 || b.pattern;
+    // The pattern's %d takes an int, so every generated number must be one
+    bool in_range = b.count <= INT_MAX && b.first >= INT_MIN && b.first <= INT_MAX &&
+                    (b.count == 0 || b.first <= INT_MAX - (b.count - 1));
+    bool have_string = optind == argc - 1;
+    if (b.threads < 1 || b.manifest == generate || optind < argc - 1 ||
+        (b.manifest && (have_string || payload_file)) ||
+        (generate && (b.count < 0 || !in_range || !b.pattern || !valid_pattern(b.pattern) ||
+                      have_string == (payload_file != NULL)))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (dir) {
+        b.dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (b.dirfd == -1) {
+            syslog(LOG_ERR, "Failed to open directory: %s", dir);
+            fprintf(stderr, "Error: %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+    }
+
+    char *string_payload = NULL;
+    int rc = 1;
+    if (b.manifest) {
+        if (read_manifest(&b) < 0)
+            goto out;
+    } else if (payload_file) {
+        if (load_payload(&b, payload_file) < 0)
+            goto out;
+    } else {
+        string_payload = make_payload(argv[optind], strlen(argv[optind]), &b.payload_len);
+        if (!string_payload) {
+            fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+            goto out;
+        }
+        b.payload = string_payload;
+    }
+    rc = run_batch(&b);
+
+out:
+    for (size_t i = 0; i < b.num_jobs; i++) {
+        free((char *)b.jobs[i].path);
+        free((char *)b.jobs[i].data);
+    }
+    free(b.jobs);
+    free(string_payload);
+    if (payload_file && b.payload_len > 0)
+        munmap((char *)b.payload, b.payload_len);
+    if (b.dirfd != AT_FDCWD)
+        close(b.dirfd);
+    return rc;
+}
 
 int main(int argc, char *argv[]) {
     // Open syslog with LOG_USER facility
     openlog("writer", LOG_PID, LOG_USER);
 
+    // Any option selects batch mode, which creates many files in one process
+    if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        int rc = batch_main(argc, argv);
+        closelog();
+        return rc;
+    }
+
     // Check if the correct number of arguments are provided
     if (argc != 3) {
         syslog(LOG_ERR, "Invalid number of arguments: %d (expected 2)", argc - 1);
@@ -47,4 +437,4 @@ int main(int argc, char *argv[]) {
     closelog();
 
     return 0;
-}
\ No newline at end of file
+}
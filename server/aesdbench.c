@@ -0,0 +1,332 @@
+/**
+ * Load generator for aesdsocket.
+ *
+ * Opens N concurrent connections (one thread each), sends newline-terminated packets of a
+ * configurable size, optionally at a fixed per-connection rate, checks that each echo holds
+ * the packet just sent, and reports throughput and latency percentiles.
+ *
+ * Every packet carries a unique "connection:sequence" tag, so it occurs exactly once in the
+ * server's history.  Without -k each packet uses a new connection, and its echo (read until
+ * the server closes) must contain the packet.  With -k (the server must run with -k too) a
+ * connection carries one outstanding packet at a time, and its echo is complete as soon as
+ * the received stream ends with the packet.  Either way the server echoes its whole history,
+ * so the echo size, and with it the latency, grows over a run; restart the server between
+ * runs that are to be compared.
+ *
+ * With -r, send times follow a fixed schedule and latency is measured from the scheduled
+ * time, so a stalled server is charged for the packets it delayed (no coordinated omission).
+ */
+#define _GNU_SOURCE // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "histogram.h"
+
+#define RECV_CHUNK 65536
+#define MIN_PACKET_SIZE 48 // Room for the longest tag and the newline
+
+struct bench_config {
+    const char *host;
+    const char *port;
+    int connections;
+    long packets;          // Per connection, unless duration is set
+    double duration;       // Seconds, 0 to send a fixed number of packets
+    size_t packet_size;    // Bytes per packet, including the newline
+    double rate;           // Packets per second per connection, 0 for closed loop
+    bool persistent;
+};
+
+// Results of one connection thread, merged after all threads have finished
+struct bench_worker {
+    pthread_t tid;
+    int id;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t mismatches;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t latency_count;
+    uint64_t latency_max;
+    uint64_t latency[HIST_BUCKETS];
+};
+
+static struct bench_config config = {
+    .host = "127.0.0.1",
+    .port = "9000",
+    .connections = 8,
+    .packets = 1000,
+    .packet_size = 64,
+};
+static struct addrinfo *server_addr;
+static uint64_t deadline_ns;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t when)
+{
+    struct timespec ts = { .tv_sec = when / 1000000000ull, .tv_nsec = when % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int bench_connect(void)
+{
+    for (struct addrinfo *ai = server_addr; ai; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Read the echo of @param packet from @param fd.  A persistent echo ends once the stream
+ * ends with the packet; a one-shot echo ends when the server closes and must contain it.
+ * @return 1 if the echo checked out, 0 if it did not, -1 on a socket error.
+ */
+static int read_echo(struct bench_worker *w, int fd, const char *packet, size_t len, char *buf)
+{
+    size_t carry = 0; // Bytes kept from the previous chunk at the front of buf
+    bool found = false;
+
+    while (1) {
+        ssize_t n = recv(fd, buf + carry, RECV_CHUNK, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return config.persistent ? -1 : found;
+        w->bytes_received += n;
+
+        size_t have = carry + n;
+        if (config.persistent) {
+            if (have >= len && memcmp(buf + have - len, packet, len) == 0)
+                return 1;
+        } else if (!found) {
+            found = memmem(buf, have, packet, len) != NULL;
+        }
+
+        // Keep enough of the tail to match a packet split across chunks
+        carry = have < len - 1 ? have : len - 1;
+        memmove(buf, buf + have - carry, carry);
+    }
+}
+
+static void record_latency(struct bench_worker *w, uint64_t latency)
+{
+    w->latency[hist_bucket(latency)]++;
+    w->latency_count++;
+    if (latency > w->latency_max)
+        w->latency_max = latency;
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_worker *w = arg;
+    char *packet = malloc(config.packet_size);
+    char *buf = malloc(RECV_CHUNK + config.packet_size);
+    uint64_t interval = config.rate > 0 ? (uint64_t)(1e9 / config.rate) : 0;
+    uint64_t next = now_ns();
+    int fd = -1;
+
+    if (!packet || !buf) {
+        fprintf(stderr, "Memory allocation failed\n");
+        w->errors++;
+        goto out;
+    }
+
+    for (long seq = 0; deadline_ns ? now_ns() < deadline_ns : seq < config.packets; seq++) {
+        int tag = snprintf(packet, config.packet_size, "aesdbench %d:%ld ", w->id, seq);
+        memset(packet + tag, 'x', config.packet_size - 1 - tag);
+        packet[config.packet_size - 1] = '\n';
+
+        uint64_t start;
+        if (interval) {
+            sleep_until(next);
+            start = next;
+            next += interval;
+        } else {
+            start = now_ns();
+        }
+
+        if (fd == -1 && (fd = bench_connect()) == -1) {
+            w->errors++;
+            continue;
+        }
+        int rc = send_all(fd, packet, config.packet_size);
+        if (rc == 0) {
+            w->bytes_sent += config.packet_size;
+            rc = read_echo(w, fd, packet, config.packet_size, buf);
+        }
+        if (rc < 0) {
+            w->errors++;
+        } else {
+            w->requests++;
+            if (rc == 0)
+                w->mismatches++;
+            record_latency(w, now_ns() - start);
+        }
+        if (rc < 0 || !config.persistent) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+out:
+    if (fd != -1)
+        close(fd);
+    free(packet);
+    free(buf);
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-n packets | -d seconds]\n"
+                    "          [-s packet_size] [-r packets_per_second] [-k]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "H:p:c:n:d:s:r:k")) != -1) {
+        switch (c) {
+        case 'H':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = optarg;
+            break;
+        case 'c':
+            config.connections = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'n':
+            config.packets = strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            config.duration = strtod(optarg, NULL);
+            break;
+        case 's':
+            config.packet_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            config.rate = strtod(optarg, NULL);
+            break;
+        case 'k':
+            config.persistent = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.connections < 1 || config.packets < 1 || config.duration < 0 ||
+        config.packet_size < MIN_PACKET_SIZE || config.rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int status = getaddrinfo(config.host, config.port, &hints, &server_addr);
+    if (status != 0) {
+        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(status));
+        return 1;
+    }
+
+    struct bench_worker *workers = calloc(config.connections, sizeof(*workers));
+    if (!workers) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    if (config.duration > 0)
+        deadline_ns = start + (uint64_t)(config.duration * 1e9);
+    int started;
+    for (started = 0; started < config.connections; started++) {
+        workers[started].id = started;
+        if (pthread_create(&workers[started].tid, NULL, bench_thread, &workers[started]) != 0) {
+            fprintf(stderr, "Failed to create thread %d\n", started);
+            break;
+        }
+    }
+
+    struct bench_worker total = { 0 };
+    for (int i = 0; i < started; i++) {
+        struct bench_worker *w = &workers[i];
+        pthread_join(w->tid, NULL);
+        total.requests += w->requests;
+        total.errors += w->errors;
+        total.mismatches += w->mismatches;
+        total.bytes_sent += w->bytes_sent;
+        total.bytes_received += w->bytes_received;
+        total.latency_count += w->latency_count;
+        if (w->latency_max > total.latency_max)
+            total.latency_max = w->latency_max;
+        for (unsigned int b = 0; b < HIST_BUCKETS; b++)
+            total.latency[b] += w->latency[b];
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    printf("%d connections, %zu-byte packets, %s, ", started, config.packet_size,
+           config.persistent ? "persistent" : "connection per packet");
+    if (config.rate > 0)
+        printf("%.1f packets/s per connection\n", config.rate);
+    else
+        printf("closed loop\n");
+    printf("requests: %llu ok, %llu errors, %llu verify failures in %.3f s\n",
+           (unsigned long long)total.requests, (unsigned long long)total.errors,
+           (unsigned long long)total.mismatches, elapsed);
+    printf("throughput: %.1f requests/s, sent %.3f MiB/s, echoed %.3f MiB/s\n",
+           total.requests / elapsed, total.bytes_sent / elapsed / (1 << 20),
+           total.bytes_received / elapsed / (1 << 20));
+    printf("latency (us): p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+           hist_quantile(total.latency, total.latency_count, total.latency_max, 0.5) / 1e3,
+           hist_quantile(total.latency, total.latency_count, total.latency_max, 0.99) / 1e3,
+           hist_quantile(total.latency, total.latency_count, total.latency_max, 0.999) / 1e3,
+           total.latency_max / 1e3);
+
+    freeaddrinfo(server_addr);
+    free(workers);
+    return total.errors || total.mismatches || started < config.connections ? 2 : 0;
+}
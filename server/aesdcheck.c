@@ -0,0 +1,184 @@
+/**
+ * Framing regression check for aesdsocket connections that carry a single record (no -k).
+ *
+ * Each case opens a connection, sends its payload in one send(), optionally closes the
+ * sending side, and reads the echo until the server closes the connection.  The echo is
+ * the server's history as of the append, so it must hold the payload exactly once: a record
+ * that was cut short, dropped, or appended twice shows up as a missing or repeated tag.
+ * Every payload line carries a "aesdcheck-<pid>-<case>" tag, so the check does not depend on
+ * what the history held before.  Works with every -m mode, -g and -w.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define RECV_CHUNK 65536
+#define TIMEOUT_SECONDS 5
+
+struct check_case {
+    const char *name;
+    const char *format; // Payload, every "%s" is replaced by the case's tag
+    bool half_close;    // Close the sending side after the payload
+};
+
+static const struct check_case cases[] = {
+    { "final packet without a newline", "%s:last", true },
+    { "several packets in one send", "%s:first\n%s:second\n%s:third\n", false },
+};
+
+static struct addrinfo *server_addr;
+
+static int check_connect(void)
+{
+    for (struct addrinfo *ai = server_addr; ai; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            struct timeval timeout = { .tv_sec = TIMEOUT_SECONDS };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// @return the number of times @param needle occurs in the @param len bytes at @param data
+static size_t count_occurrences(const char *data, size_t len, const char *needle)
+{
+    size_t count = 0, nlen = strlen(needle);
+    for (size_t i = 0; i + nlen <= len; i++) {
+        if (memcmp(data + i, needle, nlen) == 0)
+            count++;
+    }
+    return count;
+}
+
+/**
+ * Read until the server closes @param fd into a malloc()ed buffer.
+ * @return the buffer (its size in *@param len), or NULL on error.
+ */
+static char *read_echo(int fd, size_t *len)
+{
+    size_t size = 0, cap = RECV_CHUNK;
+    char *buf = malloc(cap);
+    while (buf) {
+        if (cap - size < RECV_CHUNK) {
+            char *grown = realloc(buf, cap * 2);
+            if (!grown)
+                break;
+            buf = grown;
+            cap *= 2;
+        }
+        ssize_t n = recv(fd, buf + size, cap - size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fprintf(stderr, "recv failed: %s\n", strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            *len = size;
+            return buf;
+        }
+        size += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+// @return true if the echo of @param c holds its payload exactly once
+static bool run_case(const struct check_case *c, unsigned int index)
+{
+    char tag[64], payload[512];
+    snprintf(tag, sizeof(tag), "aesdcheck-%d-%u", (int)getpid(), index);
+    snprintf(payload, sizeof(payload), c->format, tag, tag, tag);
+
+    int fd = check_connect();
+    if (fd == -1) {
+        printf("FAIL %s: could not connect\n", c->name);
+        return false;
+    }
+    if (send_all(fd, payload, strlen(payload)) < 0 || (c->half_close && shutdown(fd, SHUT_WR) == -1)) {
+        printf("FAIL %s: send failed: %s\n", c->name, strerror(errno));
+        close(fd);
+        return false;
+    }
+    size_t len;
+    char *echo = read_echo(fd, &len);
+    close(fd);
+    if (!echo) {
+        printf("FAIL %s: no complete echo\n", c->name);
+        return false;
+    }
+
+    size_t want = count_occurrences(payload, strlen(payload), tag);
+    size_t got = count_occurrences(echo, len, tag);
+    bool ok = got == want && count_occurrences(echo, len, payload) == 1;
+    if (ok)
+        printf("ok   %s\n", c->name);
+    else
+        printf("FAIL %s: tag found %zu times in the %zu-byte echo, expected %zu\n", c->name, got, len, want);
+    free(echo);
+    return ok;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = "127.0.0.1", *port = "9000";
+    int c;
+
+    while ((c = getopt(argc, argv, "H:p:")) != -1) {
+        switch (c) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    int status = getaddrinfo(host, port, &hints, &server_addr);
+    if (status != 0) {
+        fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(status));
+        return 1;
+    }
+
+    unsigned int failed = 0;
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        failed += !run_case(&cases[i], i);
+    freeaddrinfo(server_addr);
+    return failed ? 1 : 0;
+}
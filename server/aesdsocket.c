@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,13 +14,54 @@
 #include <sys/select.h>
 #include <pthread.h>
 #include <time.h>
+#include <sys/uio.h>
+#include <sched.h>
+#include <linux/filter.h>
 
-#define PORT "9000" // Port as a string for getaddrinfo
-#define BUFFER_SIZE 1024
-#define DATA_FILE "/var/tmp/aesdsocketdata"
+#include "aesdsocket.h"
+#include "datalog.h"
+#include "commit.h"
+#include "echo.h"
+#include "handoff.h"
+#include "history.h"
+#include "metrics.h"
+#include "packet.h"
+#include "pool.h"
+#include "reactor.h"
+#include "slab.h"
+#include "timestamp.h"
+#include "uring.h"
 
+struct server_config config = {
+    .mode = MODE_THREAD,
+    .zero_copy = true,
+    .queue_depth = 128,
+    .listen_backlog = 5,
+    .commit_batch = 64,
+    .log_rate = 100,
+    .timestamp_ms = 10000,
+    .segment_size = SEGMENT_SIZE_DEFAULT,
+};
+struct server_stats stats;
 volatile sig_atomic_t stop_flag = 0;
-pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+volatile sig_atomic_t drain_flag = 0;
+pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes appenders only
+struct datalog data_log = { .fd = -1 };
+
+// Per-connection log lines written and suppressed in the current one-second window
+static atomic_long log_window;
+static atomic_int log_lines;
+static atomic_ulong log_suppressed;
+
+// Connection thread (-m thread), listed while it serves so shutdown can stop and wait for it
+struct client_thread {
+    struct client client;
+    struct client_thread *prev;
+    struct client_thread *next;
+};
+static struct client_thread *client_threads;
+static pthread_mutex_t client_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t client_threads_cond = PTHREAD_COND_INITIALIZER; // Signalled when the list empties
 
 // Signal handler for SIGINT and SIGTERM
 void handle_signal(int signum) {
@@ -30,119 +72,311 @@ void handle_signal(int signum) {
     }
 }
 
-// Thread function to handle client connections
-void *handle_client(void *arg) {
-    int client_fd = *(int *)arg;
-    free(arg); // Free the allocated memory for client_fd
-    
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    char *complete_packet = NULL;
-    size_t packet_size = 0;
-
-    // Read data until newline is found
-    while ((bytes_read = recv(client_fd, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytes_read] = '\0';
-        
-        // Append to complete packet
-        char *new_packet = realloc(complete_packet, packet_size + bytes_read + 1);
-        if (!new_packet) {
-            syslog(LOG_ERR, "Memory allocation failed");
-            free(complete_packet);
-            close(client_fd);
-            return NULL;
+// Rate limit per-connection log lines to config.log_rate per second
+static bool connection_log_allowed(void) {
+    if (config.log_rate < 0)
+        return true;
+
+    long now = (long)time(NULL);
+    long window = atomic_load_explicit(&log_window, memory_order_relaxed);
+    if (now != window && atomic_compare_exchange_strong(&log_window, &window, now)) {
+        atomic_store(&log_lines, 0);
+        unsigned long suppressed = atomic_exchange(&log_suppressed, 0);
+        if (suppressed > 0)
+            syslog(LOG_INFO, "Suppressed %lu connection log messages", suppressed);
+    }
+    if (atomic_fetch_add_explicit(&log_lines, 1, memory_order_relaxed) < config.log_rate)
+        return true;
+    atomic_fetch_add_explicit(&log_suppressed, 1, memory_order_relaxed);
+    return false;
+}
+
+void log_client_address(const struct sockaddr_storage *client_addr) {
+    if (!connection_log_allowed())
+        return;
+
+    char client_ip[INET6_ADDRSTRLEN];
+    if (client_addr->ss_family == AF_INET) {
+        // IPv4
+        const struct sockaddr_in *s = (const struct sockaddr_in *)client_addr;
+        inet_ntop(AF_INET, &s->sin_addr, client_ip, sizeof(client_ip));
+    } else {
+        // IPv6
+        const struct sockaddr_in6 *s = (const struct sockaddr_in6 *)client_addr;
+        inet_ntop(AF_INET6, &s->sin6_addr, client_ip, sizeof(client_ip));
+    }
+    syslog(LOG_INFO, "Accepted connection from %s", client_ip);
+    printf("Accepted connection from %s\n", client_ip);
+}
+
+void log_client_closed(void) {
+    metrics_count(COUNTER_CLOSED, 1);
+    if (connection_log_allowed())
+        syslog(LOG_INFO, "Closed connection from client");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d] [-c] [-k] [-m thread|pool|epoll|uring] [-t threads] [-q queue_depth]\n"
+                    "          [-l listen_backlog] [-g] [-b commit_batch] [-D commit_delay_us] [-f]\n"
+                    "          [-M metrics_port|metrics_socket_path] [-L connection_logs_per_second]\n"
+                    "          [-w history_writes] [-T timestamp_interval_seconds]\n"
+                    "          [-S segment_dir [-Z segment_bytes] [-B retain_bytes] [-A retain_seconds] [-R]]\n"
+                    "          [-P] [-C cpu_list] [-H handoff_socket_path]\n",
+            prog);
+}
+
+// Persistent-connection handler: serve pipelined packets until the client closes
+static void handle_client_pipelined(int client_fd, uint64_t accepted_ns) {
+    struct packet_buffer rx;
+    struct echo_queue acks;
+    bool eof = false;
+
+    packet_buffer_init(&rx);
+    echo_queue_init(&acks);
+
+    while (!eof) {
+        size_t avail;
+        char *space = packet_buffer_reserve(&rx, &avail);
+        if (!space)
+            break;
+        ssize_t bytes_read = recv(client_fd, space, avail, 0);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "recv failed: %s", strerror(errno));
+            break;
         }
-        
-        complete_packet = new_packet;
-        memcpy(complete_packet + packet_size, buffer, bytes_read);
-        packet_size += bytes_read;
-        
-        // Check if packet contains newline
-        if (strchr(buffer, '\n'))
+        if (bytes_read > 0 && accepted_ns) {
+            metrics_since(HIST_FIRST_BYTE, accepted_ns);
+            accepted_ns = 0;
+        }
+        if (bytes_read == 0)
+            eof = true;
+        packet_buffer_commit(&rx, bytes_read);
+
+        // Append and acknowledge every packet received so far, in order
+        int appended;
+        while ((appended = packet_append_ready(&rx, &acks, eof, ECHO_QUEUE_DEPTH)) > 0) {
+            while (!echo_queue_empty(&acks)) {
+                if (echo_queue_send(&acks, client_fd, MSG_NOSIGNAL) < 0 && errno != EINTR) {
+                    syslog(LOG_ERR, "send failed: %s", strerror(errno));
+                    appended = -1;
+                    break;
+                }
+            }
+            if (appended < 0)
+                break;
+        }
+        if (appended < 0)
+            break;
+    }
+
+    packet_buffer_free(&rx);
+    echo_queue_release(&acks);
+}
+
+// Send the newest config.history_writes records back to the client (-w)
+static void echo_history(int client_fd) {
+    char *data;
+    uint64_t echo_ns = metrics_now();
+    ssize_t len = history_snapshot(&data);
+    if (len < 0)
+        return;
+
+    size_t sent = 0;
+    while (sent < (size_t)len) {
+        ssize_t n = send(client_fd, data + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "send failed: %s", strerror(errno));
             break;
+        }
+        sent += n;
+    }
+    free(data);
+    metrics_count(COUNTER_BYTES_ECHOED, sent);
+    if (sent == (size_t)len)
+        metrics_since(HIST_ECHO, echo_ns);
+}
+
+// Serve one accepted client connection to completion and close it
+void serve_client(const struct client *client) {
+    int client_fd = client->fd;
+
+    if (config.persistent) {
+        handle_client_pipelined(client_fd, client->accepted_ns);
+        close(client_fd);
+        log_client_closed();
+        return;
+    }
+
+    struct packet_buffer rx;
+    struct datalog_record record;
+    ssize_t bytes_read = 1;
+    int found = 0;
+
+    packet_buffer_init(&rx);
+
+    // Read data into slabs until a newline is found (or the client closes)
+    while (found == 0 && bytes_read > 0) {
+        size_t avail;
+        char *space = packet_buffer_reserve(&rx, &avail);
+        if (!space) {
+            packet_buffer_free(&rx);
+            close(client_fd);
+            return;
+        }
+        bytes_read = recv(client_fd, space, avail, 0);
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "recv failed: %s", strerror(errno));
+            packet_buffer_free(&rx);
+            close(client_fd);
+            return;
+        }
+        if (bytes_read > 0 && rx.received == 0)
+            metrics_since(HIST_FIRST_BYTE, client->accepted_ns);
+        packet_buffer_commit(&rx, bytes_read);
+        // One record: every packet up to the last newline, or everything at EOF
+        found = packet_collect_record(&rx, &record, bytes_read == 0);
     }
-    
-    if (bytes_read < 0) {
-        syslog(LOG_ERR, "recv failed: %s", strerror(errno));
-        free(complete_packet);
+
+    // Append to the data log, holding the mutex (or waiting for the group commit) for the append only
+    if (found < 0 || (found > 0 && commit_append(&record, 1, NULL) < 0)) {
+        packet_buffer_free(&rx);
         close(client_fd);
-        return NULL;
-    }
-    
-    // Write to file with mutex protection
-    pthread_mutex_lock(&file_mutex);
-    FILE *data_file = fopen(DATA_FILE, "a+");
-    if (!data_file) {
-        syslog(LOG_ERR, "Failed to open data file: %s", strerror(errno));
-        pthread_mutex_unlock(&file_mutex);
-        free(complete_packet);
+        return;
+    }
+    packet_buffer_free(&rx);
+
+    if (config.history_writes) {
+        echo_history(client_fd);
         close(client_fd);
-        return NULL;
-    }
-    
-    // Write the complete packet
-    if (complete_packet && packet_size > 0) {
-        fwrite(complete_packet, 1, packet_size, data_file);
-        fflush(data_file);
-    }
-    
-    // Read the entire file and send back to client
-    rewind(data_file);
-    while ((bytes_read = fread(buffer, 1, BUFFER_SIZE, data_file)) > 0) {
-        if (send(client_fd, buffer, bytes_read, 0) < 0) {
+        log_client_closed();
+        return;
+    }
+
+    // Send the committed history back to the client without holding any lock,
+    // so a slow reader never stalls other writers or the timestamp timer
+    struct echo echo;
+    uint64_t echo_ns = metrics_now();
+    echo_start(&echo, datalog_length(&data_log));
+    while (!echo_done(&echo)) {
+        if (echo_send(&echo, client_fd, MSG_NOSIGNAL) < 0) {
+            if (errno == EINTR)
+                continue;
             syslog(LOG_ERR, "send failed: %s", strerror(errno));
             break;
         }
     }
-    
-    fclose(data_file);
-    pthread_mutex_unlock(&file_mutex);
-    
-    free(complete_packet);
+    if (echo_done(&echo))
+        metrics_since(HIST_ECHO, echo_ns);
+    echo_finish(&echo);
+
     close(client_fd);
-    syslog(LOG_INFO, "Closed connection from client");
-    
-    return NULL;
+    log_client_closed();
 }
 
-// Timer thread function to append timestamps
-void *timestamp_thread(void *arg) {
-    (void)arg; // Explicitly mark the parameter as unused
-    while (!stop_flag) {
-        sleep(10); // Wait for 10 seconds
-
-        pthread_mutex_lock(&file_mutex); // Lock the mutex
-        FILE *data_file = fopen(DATA_FILE, "a");
-        if (!data_file) {
-            syslog(LOG_ERR, "Failed to open data file: %s", strerror(errno));
-            pthread_mutex_unlock(&file_mutex); // Unlock the mutex
-            continue;
-        }
+void pin_event_loop(int index) {
+    if (config.num_cpus == 0)
+        return;
+
+    int cpu = config.cpus[index % config.num_cpus];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+        syslog(LOG_WARNING, "Failed to pin event loop %d to CPU %d: %s", index, cpu, strerror(rc));
+}
 
-        time_t now = time(NULL);
-        char timestamp[64];
-        strftime(timestamp, sizeof(timestamp), "%a, %d %b %Y %H:%M:%S %z", localtime(&now));
-        fprintf(data_file, "timestamp:%s\n", timestamp);
-        fflush(data_file);
-        fclose(data_file);
-        pthread_mutex_unlock(&file_mutex); // Unlock the mutex
+// Parse a CPU list such as "0-3,8" into config.cpus; @return 0 on success, -1 if malformed
+static int parse_cpu_list(const char *list) {
+    static int cpus[CPU_SETSIZE];
+    unsigned int count = 0;
+    const char *p = list;
+
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p)
+            return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE || count + (last - first) >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus[count++] = (int)cpu;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
     }
-    return NULL;
+    if (count == 0)
+        return -1;
+    config.cpus = cpus;
+    config.num_cpus = count;
+    return 0;
 }
 
-int main(int argc, char *argv[]) {
-    int daemon_mode = 0;
-    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
-        daemon_mode = 1;
-        printf("Running in daemon mode.\n");
+// Create a socket listening on @param res, joining the SO_REUSEPORT group of the port if @param reuseport
+static int open_listener(const struct addrinfo *res, bool reuseport) {
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
+        printf("Failed to create socket: %s\n", strerror(errno));
+        return -1;
     }
 
-    openlog("aesdsocket", LOG_PID, LOG_USER);
+    // Set SO_REUSEADDR option
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        syslog(LOG_ERR, "Failed to set SO_REUSEADDR: %s", strerror(errno));
+        printf("Failed to set SO_REUSEADDR: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        syslog(LOG_ERR, "Failed to set SO_REUSEPORT: %s", strerror(errno));
+        printf("Failed to set SO_REUSEPORT: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
 
-    int server_fd, client_fd;
+    // Bind socket to port
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        syslog(LOG_ERR, "Failed to bind socket: %s", strerror(errno));
+        printf("Failed to bind socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Listen for connections
+    if (listen(fd, config.listen_backlog) == -1) {
+        syslog(LOG_ERR, "Failed to listen on socket: %s", strerror(errno));
+        printf("Failed to listen on socket: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void close_listeners(int *fds, int count) {
+    for (int i = 0; i < count; i++)
+        close(fds[i]);
+    free(fds);
+}
+
+// Open one listening socket on PORT, or with -P one per event loop thread; @return how many, or -1
+static int open_listeners(int **fds) {
     struct addrinfo hints, *res;
-    struct sockaddr_storage client_addr;
-    socklen_t client_len = sizeof(client_addr);
 
     // Configure hints for getaddrinfo
     memset(&hints, 0, sizeof(hints));
@@ -158,57 +392,368 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
-    // Create socket
-    server_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (server_fd == -1) {
-        syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
-        printf("Failed to create socket: %s\n", strerror(errno));
+    // All bound with SO_REUSEPORT when there are several
+    int count = config.reuseport ? config.num_threads : 1;
+    *fds = calloc(count, sizeof(**fds));
+    if (!*fds) {
+        printf("Failed to allocate memory\n");
         freeaddrinfo(res);
         return -1;
     }
+    for (int i = 0; i < count; i++) {
+        (*fds)[i] = open_listener(res, config.reuseport);
+        if ((*fds)[i] == -1) {
+            close_listeners(*fds, i);
+            freeaddrinfo(res);
+            return -1;
+        }
+    }
 
-    // Set SO_REUSEADDR option
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        syslog(LOG_ERR, "Failed to set SO_REUSEADDR: %s", strerror(errno));
-        printf("Failed to set SO_REUSEADDR: %s\n", strerror(errno));
-        close(server_fd);
-        freeaddrinfo(res);
+    // Free the address info structure
+    freeaddrinfo(res);
+    return count;
+}
+
+/**
+ * Serve the @param count listening sockets taken over from a previous instance (-H) as if
+ * opened here: sockets beyond what this mode accepts from are closed, and listen() again
+ * applies our -l.  @return how many are kept.
+ */
+static int adopt_listeners(int *fds, int count) {
+    int served = config.mode == MODE_EPOLL || config.mode == MODE_URING ? config.num_threads : 1;
+    if (count > served) {
+        syslog(LOG_WARNING, "Closing %d inherited listening sockets beyond the %d served",
+               count - served, served);
+        for (int i = served; i < count; i++)
+            close(fds[i]);
+        count = served;
+    }
+    for (int i = 0; i < count; i++) {
+        if (listen(fds[i], config.listen_backlog) == -1)
+            syslog(LOG_WARNING, "Failed to set listen backlog: %s", strerror(errno));
+    }
+    syslog(LOG_INFO, "Took over %d listening sockets", count);
+    printf("Took over %d listening sockets\n", count);
+    return count;
+}
+
+/**
+ * When every event loop i is pinned to a CPU c with c % @param count == i, hand each new
+ * connection to listener (receiving CPU % count) so it is accepted on the core that took
+ * its packets; otherwise the kernel keeps spreading connections by hash.
+ * Listener i is the i-th socket that joined the group.  @return true if steering is on.
+ */
+static bool steer_by_cpu(const int *fds, int count) {
+    if (config.num_cpus == 0)
+        return false;
+    for (int i = 0; i < count; i++) {
+        if (config.cpus[i % config.num_cpus] % count != i)
+            return false;
+    }
+
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { .len = sizeof(code) / sizeof(code[0]), .filter = code };
+    if (setsockopt(fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == -1) {
+        syslog(LOG_WARNING, "Failed to steer connections by CPU: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void client_thread_add(struct client_thread *ct) {
+    pthread_mutex_lock(&client_threads_mutex);
+    ct->prev = NULL;
+    ct->next = client_threads;
+    if (client_threads)
+        client_threads->prev = ct;
+    client_threads = ct;
+    pthread_mutex_unlock(&client_threads_mutex);
+}
+
+static void client_thread_remove(struct client_thread *ct) {
+    pthread_mutex_lock(&client_threads_mutex);
+    if (ct->prev)
+        ct->prev->next = ct->next;
+    else
+        client_threads = ct->next;
+    if (ct->next)
+        ct->next->prev = ct->prev;
+    if (!client_threads)
+        pthread_cond_broadcast(&client_threads_cond);
+    pthread_mutex_unlock(&client_threads_mutex);
+    free(ct);
+}
+
+// @return true when no connection thread is serving (hot restart drain)
+static bool client_threads_idle(void) {
+    pthread_mutex_lock(&client_threads_mutex);
+    bool idle = client_threads == NULL;
+    pthread_mutex_unlock(&client_threads_mutex);
+    return idle;
+}
+
+// Wake the connection threads out of recv()/send() and wait until all have finished
+static void client_threads_stop(void) {
+    pthread_mutex_lock(&client_threads_mutex);
+    for (struct client_thread *ct = client_threads; ct; ct = ct->next)
+        shutdown(ct->client.fd, SHUT_RDWR);
+    while (client_threads)
+        pthread_cond_wait(&client_threads_cond, &client_threads_mutex);
+    pthread_mutex_unlock(&client_threads_mutex);
+}
+
+// Thread function to handle client connections
+void *handle_client(void *arg) {
+    struct client_thread *ct = arg;
+
+    serve_client(&ct->client);
+    client_thread_remove(ct);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    long nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+    int c;
+
+    config.num_threads = nprocs > 0 ? (int)nprocs : 1;
+    while ((c = getopt(argc, argv, "dckm:t:q:l:gb:D:fM:L:w:T:S:Z:B:A:RPC:H:")) != -1) {
+        switch (c) {
+        case 'd':
+            config.daemon_mode = true;
+            printf("Running in daemon mode.\n");
+            break;
+        case 'c':
+            config.zero_copy = false;
+            break;
+        case 'k':
+            config.persistent = true;
+            break;
+        case 'q':
+            config.queue_depth = (unsigned int)strtoul(optarg, NULL, 10);
+            if (config.queue_depth < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            config.listen_backlog = (int)strtol(optarg, NULL, 10);
+            if (config.listen_backlog < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'g':
+            config.group_commit = true;
+            break;
+        case 'b':
+            config.commit_batch = (unsigned int)strtoul(optarg, NULL, 10);
+            if (config.commit_batch < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'D':
+            config.commit_delay_us = strtol(optarg, NULL, 10);
+            if (config.commit_delay_us < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'f':
+            config.commit_sync = true;
+            break;
+        case 'M':
+            config.metrics_addr = optarg;
+            break;
+        case 'L':
+            config.log_rate = (int)strtol(optarg, NULL, 10);
+            if (config.log_rate < -1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'w':
+            config.history_writes = (unsigned int)strtoul(optarg, NULL, 10);
+            if (config.history_writes < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'T': {
+            // Seconds, fractions allowed, rounded to whole milliseconds
+            char *end;
+            double seconds = strtod(optarg, &end);
+            if (*end != '\0' || !(seconds >= 0) || seconds > 86400 || (seconds > 0 && seconds < 0.001)) {
+                usage(argv[0]);
+                return -1;
+            }
+            config.timestamp_ms = (long)(seconds * 1000 + 0.5);
+            break;
+        }
+        case 'S':
+            config.segment_dir = optarg;
+            break;
+        case 'Z':
+            config.segment_size = strtoul(optarg, NULL, 10);
+            if (config.segment_size < SEGMENT_SIZE_MIN) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'B':
+            config.retain_bytes = strtoul(optarg, NULL, 10);
+            break;
+        case 'A':
+            config.retain_seconds = strtol(optarg, NULL, 10);
+            if (config.retain_seconds < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'R':
+            config.recover = true;
+            break;
+        case 'P':
+            config.reuseport = true;
+            break;
+        case 'C':
+            if (parse_cpu_list(optarg) < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'H':
+            config.handoff_path = optarg;
+            break;
+        case 'm':
+            if (strcmp(optarg, "thread") == 0) {
+                config.mode = MODE_THREAD;
+            } else if (strcmp(optarg, "pool") == 0) {
+                config.mode = MODE_POOL;
+            } else if (strcmp(optarg, "epoll") == 0) {
+                config.mode = MODE_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                config.mode = MODE_URING;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 't':
+            config.num_threads = (int)strtol(optarg, NULL, 10);
+            if (config.num_threads < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // The history echo is only implemented for one-shot connections served by a thread
+    if (config.history_writes && (config.persistent || config.mode == MODE_EPOLL || config.mode == MODE_URING)) {
+        printf("-w is not supported with -k, -m epoll or -m uring\n");
+        usage(argv[0]);
         return -1;
     }
 
-    // Bind socket to port
-    if (bind(server_fd, res->ai_addr, res->ai_addrlen) == -1) {
-        syslog(LOG_ERR, "Failed to bind socket: %s", strerror(errno));
-        printf("Failed to bind socket: %s\n", strerror(errno));
-        close(server_fd);
-        freeaddrinfo(res);
+    // The rings write the data file themselves, linked to the echo
+    if (config.group_commit && config.mode == MODE_URING) {
+        printf("-g is not supported with -m uring\n");
+        usage(argv[0]);
         return -1;
     }
 
-    // Free the address info structure
-    freeaddrinfo(res);
+    // Segment layout, retention and recovery only apply to a segment directory
+    if (!config.segment_dir && (config.segment_size != SEGMENT_SIZE_DEFAULT || config.retain_bytes ||
+                                config.retain_seconds || config.recover)) {
+        printf("-Z, -B, -A and -R need -S\n");
+        usage(argv[0]);
+        return -1;
+    }
 
-    // Listen for connections
-    if (listen(server_fd, 5) == -1) {
-        syslog(LOG_ERR, "Failed to listen on socket: %s", strerror(errno));
-        printf("Failed to listen on socket: %s\n", strerror(errno));
-        close(server_fd);
+    // Only the event loop modes have one acceptor per thread to shard and pin
+    if ((config.reuseport || config.num_cpus) && config.mode != MODE_EPOLL && config.mode != MODE_URING) {
+        printf("-P and -C need -m epoll or -m uring\n");
+        usage(argv[0]);
+        return -1;
+    }
+
+    openlog("aesdsocket", LOG_PID, LOG_USER);
+
+    int server_fd, client_fd;
+    struct sockaddr_storage client_addr;
+    socklen_t client_len = sizeof(client_addr);
+
+    // Take over the listening sockets and data of a running instance (-H), or start afresh
+    int *listen_fds = NULL, num_listeners = 0;
+    int handoff_fd = -1;
+    size_t handoff_length = 0;
+    if (config.handoff_path &&
+        (num_listeners = handoff_receive(config.handoff_path, &listen_fds, &handoff_fd, &handoff_length)) < 0) {
+        printf("Failed to take over from %s\n", config.handoff_path);
         return -1;
     }
+    bool taken_over = num_listeners > 0;
+    if (taken_over)
+        num_listeners = adopt_listeners(listen_fds, num_listeners);
+    else if ((num_listeners = open_listeners(&listen_fds)) < 0)
+        return -1;
 
-    // Create data file or truncate if it exists
-    FILE *data_file = fopen(DATA_FILE, "w");
-    if (!data_file) {
+    if (config.reuseport) {
+        bool steered = steer_by_cpu(listen_fds, num_listeners);
+        syslog(LOG_INFO, "Sharding accepts over %d SO_REUSEPORT listeners%s", num_listeners,
+               steered ? ", steered by receiving CPU" : "");
+    }
+    server_fd = listen_fds[0];
+
+    // Create data file or truncate if it exists, or open the segment directory.
+    // After a hot restart the log continues where the previous instance left it.
+    if (config.segment_dir) {
+        struct datalog_options opts = {
+            .dir = config.segment_dir,
+            .segment_size = config.segment_size,
+            .retain_bytes = config.retain_bytes,
+            .retain_seconds = config.retain_seconds,
+            .recover = config.recover || taken_over,
+        };
+        if (handoff_fd != -1)
+            close(handoff_fd); // The segment files are the data
+        if (datalog_open_dir(&data_log, &opts) < 0) {
+            printf("Failed to open segment directory %s\n", config.segment_dir);
+            close_listeners(listen_fds, num_listeners);
+            return -1;
+        }
+        if (taken_over && datalog_length(&data_log) != handoff_length)
+            syslog(LOG_WARNING, "Recovered %zu bytes of data log, previous instance had %zu",
+                   datalog_length(&data_log), handoff_length);
+    } else if (handoff_fd != -1) {
+        if (datalog_adopt(&data_log, handoff_fd, handoff_length) < 0) {
+            printf("Failed to take over data file\n");
+            close_listeners(listen_fds, num_listeners);
+            return -1;
+        }
+    } else if (datalog_open(&data_log, DATA_FILE) < 0) {
         syslog(LOG_ERR, "Failed to create data file: %s", strerror(errno));
         printf("Failed to create data file: %s\n", strerror(errno));
-        close(server_fd);
+        close_listeners(listen_fds, num_listeners);
+        return -1;
+    }
+    data_log.sync = config.commit_sync;
+    if (config.history_writes && history_init(config.history_writes) < 0) {
+        printf("Failed to allocate history of %u writes\n", config.history_writes);
+        close_listeners(listen_fds, num_listeners);
         return -1;
     }
-    fclose(data_file);
 
     // Daemonize if requested
-    if (daemon_mode) {
+    if (config.daemon_mode) {
         pid_t pid = fork();
         if (pid < 0) {
             syslog(LOG_ERR, "Failed to fork: %s", strerror(errno));
@@ -233,24 +778,77 @@ int main(int argc, char *argv[]) {
     // Handle signals
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN); // sendfile() has no MSG_NOSIGNAL, report EPIPE instead
+
+    // Enable metrics before any thread that records them is started
+    if (config.metrics_addr && metrics_start(config.metrics_addr) < 0) {
+        printf("Failed to start metrics endpoint on %s\n", config.metrics_addr);
+        close_listeners(listen_fds, num_listeners);
+        return -1;
+    }
 
-    // Create timestamp thread
-    pthread_t timestamp_tid;
-    if (pthread_create(&timestamp_tid, NULL, timestamp_thread, NULL) != 0) {
-        syslog(LOG_ERR, "Failed to create timestamp thread");
-        printf("Failed to create timestamp thread\n");
-        close(server_fd);
+    // Start the group commit writer before anything can append
+    if (commit_start() < 0) {
+        printf("Failed to start group commit writer\n");
+        close_listeners(listen_fds, num_listeners);
         return -1;
     }
 
-    while (!stop_flag) {
+    // The timestamp timer is served by the accept loop below, or by the first reactor or ring
+    int timer_fd = -1;
+    if (config.timestamp_ms > 0 && (timer_fd = timestamp_timer_open(config.timestamp_ms)) == -1) {
+        printf("Failed to create timestamp timer\n");
+        commit_stop();
+        close_listeners(listen_fds, num_listeners);
+        return -1;
+    }
+
+    // Listen for the next instance once this one is fully set up
+    if (config.handoff_path && handoff_listen(config.handoff_path) < 0) {
+        printf("Failed to listen for a successor on %s\n", config.handoff_path);
+        if (timer_fd != -1)
+            close(timer_fd);
+        commit_stop();
+        close_listeners(listen_fds, num_listeners);
+        return -1;
+    }
+
+    bool start_failed = false; // Still cleaned up below, but the exit status reports it
+    if (config.mode == MODE_URING) {
+        int rc = uring_run(listen_fds, num_listeners, config.num_threads, timer_fd);
+        if (rc == URING_UNAVAILABLE) {
+            syslog(LOG_WARNING, "io_uring unavailable, falling back to epoll reactors");
+            printf("io_uring unavailable, falling back to epoll reactors\n");
+            config.mode = MODE_EPOLL;
+        } else if (rc < 0) {
+            printf("Failed to start io_uring threads\n");
+            start_failed = true;
+        }
+    }
+
+    if (config.mode == MODE_EPOLL) {
+        if (reactor_run(listen_fds, num_listeners, config.num_threads, timer_fd) < 0) {
+            printf("Failed to start epoll reactors\n");
+            start_failed = true;
+        }
+    }
+
+    if (config.mode == MODE_POOL && pool_start() < 0) {
+        printf("Failed to start worker pool\n");
+        start_failed = true;
+        stop_flag = 1;
+    }
+
+    while ((config.mode == MODE_THREAD || config.mode == MODE_POOL) && !stop_flag && !drain_flag) {
         // Use select to make accept non-blocking
         fd_set read_fds;
         FD_ZERO(&read_fds);
         FD_SET(server_fd, &read_fds);
+        if (timer_fd != -1)
+            FD_SET(timer_fd, &read_fds);
 
         struct timeval timeout = {1, 0}; // 1 second timeout
-        int ready = select(server_fd + 1, &read_fds, NULL, NULL, &timeout);
+        int ready = select((server_fd > timer_fd ? server_fd : timer_fd) + 1, &read_fds, NULL, NULL, &timeout);
         if (ready == -1) {
             if (errno == EINTR) continue; // Interrupted by signal
             syslog(LOG_ERR, "select failed: %s", strerror(errno));
@@ -260,6 +858,11 @@ int main(int argc, char *argv[]) {
 
         if (ready == 0) continue; // Timeout, check stop_flag
 
+        if (timer_fd != -1 && FD_ISSET(timer_fd, &read_fds))
+            timestamp_timer_expired(timer_fd);
+        if (!FD_ISSET(server_fd, &read_fds))
+            continue;
+
         // Accept connection
         client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
         if (client_fd == -1) {
@@ -268,48 +871,94 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
+        struct client client = { .fd = client_fd, .accepted_ns = metrics_now() };
+        metrics_count(COUNTER_ACCEPTED, 1);
+
         // Log client IP
-        char client_ip[INET6_ADDRSTRLEN];
-        if (client_addr.ss_family == AF_INET) {
-            // IPv4
-            struct sockaddr_in *s = (struct sockaddr_in *)&client_addr;
-            inet_ntop(AF_INET, &s->sin_addr, client_ip, sizeof(client_ip));
-        } else {
-            // IPv6
-            struct sockaddr_in6 *s = (struct sockaddr_in6 *)&client_addr;
-            inet_ntop(AF_INET6, &s->sin6_addr, client_ip, sizeof(client_ip));
+        log_client_address(&client_addr);
+
+        if (config.mode == MODE_POOL) {
+            pool_submit(&client);
+            continue;
         }
-        syslog(LOG_INFO, "Accepted connection from %s", client_ip);
-        printf("Accepted connection from %s\n", client_ip);
 
         // Create a new thread to handle the client
         pthread_t tid;
-        int *client_fd_ptr = malloc(sizeof(int));
-        if (!client_fd_ptr) {
+        struct client_thread *ct = malloc(sizeof(*ct));
+        if (!ct) {
             syslog(LOG_ERR, "Failed to allocate memory");
             close(client_fd);
             continue;
         }
-        *client_fd_ptr = client_fd;
-        if (pthread_create(&tid, NULL, handle_client, client_fd_ptr) != 0) {
+        ct->client = client;
+        client_thread_add(ct);
+        if (pthread_create(&tid, NULL, handle_client, ct) != 0) {
             syslog(LOG_ERR, "Failed to create thread for client");
             printf("Failed to create thread for client\n");
-            free(client_fd_ptr);
+            client_thread_remove(ct);
             close(client_fd);
             continue;
         }
         pthread_detach(tid); // Detach thread to avoid memory leaks
     }
 
-    // Wait for timestamp thread to finish
-    pthread_cancel(timestamp_tid);
-    pthread_join(timestamp_tid, NULL);
+    // Hot restart: the event loops return once drained; wait for the threads to finish too
+    while (drain_flag && !stop_flag &&
+           (config.mode == MODE_POOL ? !pool_idle() : !client_threads_idle())) {
+        struct timespec pause = { 0, 10 * 1000000L };
+        nanosleep(&pause, NULL);
+    }
+    stop_flag = 1; // Stop the remaining threads (metrics) as on a signal
 
-    // Cleanup
-    close(server_fd);
-    remove(DATA_FILE);
+    // Connection threads use the data log, history and slabs torn down below
+    if (config.mode == MODE_POOL)
+        pool_stop();
+    else if (config.mode == MODE_THREAD)
+        client_threads_stop();
+
+    // No more timestamps once the loops have exited; commit what they queued
+    if (timer_fd != -1)
+        close(timer_fd);
+    commit_stop();
+    metrics_stop();
+
+    unsigned long echo_sendfile = atomic_load(&stats.echo_sendfile);
+    unsigned long echo_copy = atomic_load(&stats.echo_copy);
+    unsigned long sendfile_fallback = atomic_load(&stats.sendfile_fallback);
+    syslog(LOG_INFO, "Echo paths: %lu sendfile, %lu copy, %lu sendfile fallbacks",
+           echo_sendfile, echo_copy, sendfile_fallback);
+    printf("Echo paths: %lu sendfile, %lu copy, %lu sendfile fallbacks\n",
+           echo_sendfile, echo_copy, sendfile_fallback);
+    if (config.mode == MODE_POOL) {
+        unsigned long rejected = atomic_load(&stats.pool_rejected);
+        unsigned long peak = atomic_load(&stats.pool_queue_peak);
+        syslog(LOG_INFO, "Worker pool: %lu connections rejected, peak queue depth %lu", rejected, peak);
+        printf("Worker pool: %lu connections rejected, peak queue depth %lu\n", rejected, peak);
+    }
+    if (config.group_commit) {
+        unsigned long batches = atomic_load(&stats.commit_batches);
+        unsigned long records = atomic_load(&stats.commit_records);
+        syslog(LOG_INFO, "Group commit: %lu records in %lu batches", records, batches);
+        printf("Group commit: %lu records in %lu batches\n", records, batches);
+    }
+    unsigned long slab_allocated = atomic_load(&stats.slab_allocated);
+    unsigned long slab_reused = atomic_load(&stats.slab_reused);
+    syslog(LOG_INFO, "Receive slabs: %lu allocated, %lu reused", slab_allocated, slab_reused);
+    printf("Receive slabs: %lu allocated, %lu reused\n", slab_allocated, slab_reused);
+
+    // Cleanup; after a hot restart the successor owns the listening sockets and the data
+    bool handed_off = handoff_finish(listen_fds, num_listeners);
+    close_listeners(listen_fds, num_listeners);
+    datalog_close(&data_log);
+    if (config.history_writes)
+        history_free();
+    slab_pool_drain();
+    if (!config.segment_dir && !handed_off)
+        remove(DATA_FILE); // Segment files are kept for -R
     pthread_mutex_destroy(&file_mutex);
     closelog();
+    if (start_failed)
+        return -1;
     printf("Server shutdown gracefully.\n");
 
     return 0;
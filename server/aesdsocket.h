@@ -0,0 +1,94 @@
+#ifndef AESDSOCKET_H
+#define AESDSOCKET_H
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "datalog.h"
+
+#define PORT "9000" // Port as a string for getaddrinfo
+#define BUFFER_SIZE 1024
+#define DATA_FILE "/var/tmp/aesdsocketdata"
+#define SEGMENT_SIZE_DEFAULT (1024 * 1024)
+#define SEGMENT_SIZE_MIN 4096
+
+// Connection handling models selectable with -m
+enum server_mode {
+    MODE_THREAD, // One detached pthread per accepted connection
+    MODE_POOL,   // Fixed worker pool fed by a bounded queue
+    MODE_EPOLL,  // Fixed number of epoll reactor threads
+    MODE_URING,  // Fixed number of io_uring threads, falling back to MODE_EPOLL
+};
+
+// Command line configuration
+struct server_config {
+    bool daemon_mode;        // -d
+    enum server_mode mode;   // -m
+    int num_threads;         // -t, epoll reactor, io_uring or pool worker threads
+    unsigned int queue_depth; // -q, accepted connections waiting for a pool worker
+    int listen_backlog;      // -l
+    bool zero_copy;          // Echo with sendfile(), disabled with -c
+    bool persistent;         // -k, keep connections open for pipelined packets
+    bool group_commit;       // -g, append through the group commit writer thread
+    unsigned int commit_batch; // -b, records per group commit batch
+    long commit_delay_us;    // -D, how long the writer waits for a batch to fill
+    bool commit_sync;        // -f, fdatasync() once per commit (batch)
+    const char *metrics_addr; // -M, metrics endpoint (port or Unix socket path)
+    int log_rate;            // -L, per-connection log lines per second, -1 for no limit
+    unsigned int history_writes; // -w, echo only the newest writes, 0 for the whole log
+    long timestamp_ms;       // -T, interval between timestamp records, 0 for none
+    const char *segment_dir; // -S, keep the data log as segment files here instead of DATA_FILE
+    size_t segment_size;     // -Z, bytes per segment file
+    size_t retain_bytes;     // -B, drop the oldest segments beyond this many bytes, 0 for no limit
+    long retain_seconds;     // -A, drop segments filled longer ago than this, 0 for no limit
+    bool recover;            // -R, continue the segments found in segment_dir
+    bool reuseport;          // -P, one SO_REUSEPORT listening socket per event loop thread
+    const int *cpus;         // -C, CPUs to pin event loop thread i to, cpus[i % num_cpus]
+    unsigned int num_cpus;   // 0 to leave event loop threads unpinned
+    const char *handoff_path; // -H, Unix socket for hot restarts, see handoff.h
+};
+
+// An accepted connection on its way to a handler
+struct client {
+    int fd;
+    uint64_t accepted_ns; // metrics_now() at accept(), 0 when metrics are disabled
+};
+
+// Counters reported at shutdown
+struct server_stats {
+    atomic_ulong echo_sendfile;     // Echoes started on the sendfile() path
+    atomic_ulong echo_copy;         // Echoes started on the copy-from-memory path
+    atomic_ulong sendfile_fallback; // sendfile() refusals that switched to copying
+    atomic_ulong pool_queue_depth;  // Connections currently waiting for a pool worker
+    atomic_ulong pool_queue_peak;   // Highest pool_queue_depth seen
+    atomic_ulong pool_rejected;     // Connections turned away because the queue was full
+    atomic_ulong commit_batches;    // writev() batches written by the group commit writer
+    atomic_ulong commit_records;    // Records written by the group commit writer
+    atomic_ulong slab_allocated;    // Receive slabs obtained from malloc()
+    atomic_ulong slab_reused;       // Receive slabs recycled from a thread cache or the pool
+};
+
+extern struct server_config config;
+extern struct server_stats stats;
+extern volatile sig_atomic_t stop_flag;
+extern volatile sig_atomic_t drain_flag; // Hot restart: stop accepting and let open connections finish
+extern pthread_mutex_t file_mutex;     // Serializes appends to data_log; readers take no lock
+extern struct datalog data_log;        // In-memory mirror of DATA_FILE
+
+// Serve one accepted client connection to completion and close it
+void serve_client(const struct client *client);
+
+// Pin the calling event loop thread number @param index to its CPU from -C, if any
+void pin_event_loop(int index);
+
+// Log the peer address of an accepted connection to syslog and stdout, subject to -L
+void log_client_address(const struct sockaddr_storage *client_addr);
+
+// Count a served connection as closed and log it, subject to -L
+void log_client_closed(void);
+
+#endif /* AESDSOCKET_H */
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "history.h"
+#include "metrics.h"
+
+// commit_request.state for requests completed with commit_wait()
+enum {
+    REQ_PENDING,
+    REQ_SLEEPING, // Pending, and the submitter is blocked in futex_wait
+    REQ_DONE,
+};
+
+#define WRITER_IDLE_TIMEOUT_S 1 // Upper bound on an idle wait, in case a doorbell is missed
+
+static struct mpsc_queue queue;
+static pthread_t writer_tid;
+static bool running;
+static atomic_bool stopping;
+static atomic_bool writer_idle;
+static pthread_mutex_t doorbell_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t doorbell_cond;
+
+static void futex_wait(atomic_int *addr, int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void commit_complete(struct commit_request *req, int status)
+{
+    req->status = status;
+    if (req->complete) {
+        req->complete(req);
+        return;
+    }
+    if (atomic_exchange(&req->state, REQ_DONE) == REQ_SLEEPING)
+        futex_wake(&req->state);
+}
+
+/**
+ * Append under file_mutex, timing both the wait for the lock and the append itself.
+ * With @param offset the data file write is left to the caller (datalog_appendv_deferred()).
+ */
+static int commit_locked(const struct datalog_record *records, unsigned int count, size_t *ends,
+                         size_t *offset)
+{
+    uint64_t wait_ns = metrics_now();
+    pthread_mutex_lock(&file_mutex);
+    uint64_t append_ns = metrics_now();
+    metrics_since(HIST_LOCK_WAIT, wait_ns);
+    int rc = offset ? datalog_appendv_deferred(&data_log, records, count, ends, offset) :
+                      datalog_appendv(&data_log, records, count, ends);
+    if (rc == 0 && config.history_writes)
+        rc = history_add(records, count);
+    pthread_mutex_unlock(&file_mutex);
+    metrics_since(HIST_APPEND, append_ns);
+    if (rc == 0)
+        metrics_count(COUNTER_RECORDS, count);
+    return rc;
+}
+
+// Pop the next request, sleeping until one arrives, @param deadline passes, or we are stopping
+static struct commit_request *writer_pop_wait(const struct timespec *deadline)
+{
+    struct mpsc_node *node = mpsc_pop(&queue);
+    if (node)
+        return (struct commit_request *)node;
+
+    pthread_mutex_lock(&doorbell_mutex);
+    atomic_store(&writer_idle, true);
+    atomic_thread_fence(memory_order_seq_cst); // Pairs with the fence in commit_submit()
+    while (!(node = mpsc_pop(&queue)) && !atomic_load(&stopping)) {
+        struct timespec timeout;
+        if (deadline) {
+            timeout = *deadline;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &timeout);
+            timeout.tv_sec += WRITER_IDLE_TIMEOUT_S;
+        }
+        if (pthread_cond_timedwait(&doorbell_cond, &doorbell_mutex, &timeout) == ETIMEDOUT && deadline) {
+            node = mpsc_pop(&queue);
+            break;
+        }
+    }
+    atomic_store(&writer_idle, false);
+    pthread_mutex_unlock(&doorbell_mutex);
+    return (struct commit_request *)node;
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    struct commit_request **batch = NULL;
+    struct datalog_record *records = NULL;
+    size_t *ends = NULL;
+    size_t batch_cap = 0, records_cap = 0;
+
+    while (1) {
+        size_t nreq = 0, nrec = 0;
+        struct timespec deadline;
+        struct commit_request *req = writer_pop_wait(NULL);
+        if (!req)
+            break; // Stopping and nothing left to commit
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += config.commit_delay_us * 1000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        // Gather a batch: stop at the batch size, or once the queue stays empty past the delay
+        while (req) {
+            if (nreq == batch_cap) {
+                batch_cap = batch_cap ? batch_cap * 2 : 64;
+                struct commit_request **new_batch = realloc(batch, batch_cap * sizeof(*batch));
+                if (!new_batch) {
+                    syslog(LOG_ERR, "Memory allocation failed");
+                    commit_complete(req, -1);
+                    break;
+                }
+                batch = new_batch;
+            }
+            batch[nreq++] = req;
+            nrec += req->count;
+            if (nrec >= config.commit_batch)
+                break;
+            req = config.commit_delay_us > 0 ? writer_pop_wait(&deadline)
+                                             : (struct commit_request *)mpsc_pop(&queue);
+        }
+
+        if (nrec > records_cap) {
+            size_t cap = records_cap ? records_cap : 64;
+            while (cap < nrec)
+                cap *= 2;
+            struct datalog_record *new_records = realloc(records, cap * sizeof(*records));
+            size_t *new_ends = new_records ? realloc(ends, cap * sizeof(*ends)) : NULL;
+            if (new_records)
+                records = new_records;
+            if (new_ends)
+                ends = new_ends;
+            if (!new_records || !new_ends) {
+                syslog(LOG_ERR, "Memory allocation failed");
+                for (size_t i = 0; i < nreq; i++)
+                    commit_complete(batch[i], -1);
+                continue;
+            }
+            records_cap = cap;
+        }
+
+        size_t n = 0;
+        for (size_t i = 0; i < nreq; i++) {
+            memcpy(records + n, batch[i]->records, batch[i]->count * sizeof(*records));
+            n += batch[i]->count;
+        }
+
+        int rc = commit_locked(records, n, ends, NULL);
+
+        atomic_fetch_add_explicit(&stats.commit_batches, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats.commit_records, n, memory_order_relaxed);
+
+        n = 0;
+        for (size_t i = 0; i < nreq; i++) {
+            if (rc == 0 && batch[i]->ends)
+                memcpy(batch[i]->ends, ends + n, batch[i]->count * sizeof(*ends));
+            n += batch[i]->count;
+            commit_complete(batch[i], rc);
+        }
+    }
+
+    free(batch);
+    free(records);
+    free(ends);
+    return NULL;
+}
+
+int commit_start(void)
+{
+    if (!config.group_commit)
+        return 0;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&doorbell_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    mpsc_init(&queue);
+    atomic_store(&stopping, false);
+
+    if (pthread_create(&writer_tid, NULL, writer_thread, NULL) != 0) {
+        syslog(LOG_ERR, "Failed to create group commit writer thread");
+        pthread_cond_destroy(&doorbell_cond);
+        return -1;
+    }
+    running = true;
+    syslog(LOG_INFO, "Group commit enabled: batch %u records, max delay %ld us%s",
+           config.commit_batch, config.commit_delay_us, config.commit_sync ? ", fdatasync" : "");
+    return 0;
+}
+
+void commit_stop(void)
+{
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&doorbell_mutex);
+    atomic_store(&stopping, true);
+    pthread_cond_signal(&doorbell_cond);
+    pthread_mutex_unlock(&doorbell_mutex);
+
+    pthread_join(writer_tid, NULL);
+    running = false;
+    pthread_cond_destroy(&doorbell_cond);
+}
+
+void commit_submit(struct commit_request *req)
+{
+    atomic_store_explicit(&req->state, REQ_PENDING, memory_order_relaxed);
+    mpsc_push(&queue, &req->node);
+
+    // Only pay for the mutex when the writer is (about to be) asleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_idle, memory_order_relaxed)) {
+        pthread_mutex_lock(&doorbell_mutex);
+        pthread_cond_signal(&doorbell_cond);
+        pthread_mutex_unlock(&doorbell_mutex);
+    }
+}
+
+int commit_wait(struct commit_request *req)
+{
+    int state;
+    while ((state = atomic_load(&req->state)) != REQ_DONE) {
+        if (state == REQ_PENDING &&
+            !atomic_compare_exchange_strong(&req->state, &state, REQ_SLEEPING))
+            continue;
+        futex_wait(&req->state, REQ_SLEEPING);
+    }
+    return req->status;
+}
+
+int commit_append(const struct datalog_record *records, unsigned int count, size_t *ends)
+{
+    if (!running)
+        return commit_locked(records, count, ends, NULL);
+
+    struct commit_request req = {
+        .records = records,
+        .count = count,
+        .ends = ends,
+    };
+    commit_submit(&req);
+    return commit_wait(&req);
+}
+
+int commit_append_deferred(const struct datalog_record *records, unsigned int count, size_t *ends,
+                           size_t *offset)
+{
+    return commit_locked(records, count, ends, offset);
+}
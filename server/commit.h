@@ -0,0 +1,62 @@
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#include "datalog.h"
+#include "mpsc.h"
+
+/**
+ * One or more records to append to the data log as part of a group commit.
+ * The records and ends arrays must stay valid until the request completes.
+ */
+struct commit_request {
+    struct mpsc_node node;          // Writer queue link, free for the owner's use in complete()
+    const struct datalog_record *records;
+    unsigned int count;
+    size_t *ends;                   // ends[i] receives the log length just past records[i]
+    int status;                     // 0 once committed, -1 if the append failed
+    /**
+     * Called on the writer thread once the request is committed.  Leave NULL to wait for
+     * the request with commit_wait() instead.
+     */
+    void (*complete)(struct commit_request *req);
+    void *arg;
+    atomic_int state;
+};
+
+/**
+ * Start the group-commit writer thread when config.group_commit is set.  The writer pops
+ * requests from a lock-free MPSC queue, gathers up to config.commit_batch records (waiting
+ * at most config.commit_delay_us for the batch to fill), appends them with one writev(),
+ * optionally fdatasync()s once per batch, and then completes every request in the batch.
+ * @return 0 on success (or when group commit is disabled), -1 on failure.
+ */
+int commit_start(void);
+
+// Commit everything already queued, then stop the writer thread
+void commit_stop(void);
+
+// Queue @param req for the writer thread; the writer must be running
+void commit_submit(struct commit_request *req);
+
+// Block until @param req (submitted without a complete callback) is committed; @return its status
+int commit_wait(struct commit_request *req);
+
+/**
+ * Append @param count records and block until they are committed, through the writer
+ * thread if it is running and directly under file_mutex otherwise.
+ * @return 0 on success, -1 on failure.
+ */
+int commit_append(const struct datalog_record *records, unsigned int count, size_t *ends);
+
+/**
+ * Append @param count records directly under file_mutex, leaving the data file write to the
+ * caller: the records belong at file offset *@param offset (see datalog_appendv_deferred()).
+ * Not for use with the group commit writer.  @return 0 on success, -1 on failure.
+ */
+int commit_append_deferred(const struct datalog_record *records, unsigned int count, size_t *ends,
+                           size_t *offset);
+
+#endif /* COMMIT_H */
@@ -0,0 +1,840 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "datalog.h"
+
+#define DATALOG_SEND_IOV 16    // Segments gathered into one sendmsg()
+#define DATALOG_WRITE_IOV 1024 // IOV_MAX on Linux
+#define DATALOG_INDEX_BATCH 256 // Index entries gathered into one write()
+#define DATALOG_NAME_DIGITS 20  // Segment files are named after their base offset, zero padded
+
+typedef uint64_t datalog_index_entry;
+
+static void datalog_init(struct datalog *log)
+{
+    memset(log, 0, sizeof(*log));
+    atomic_init(&log->head, NULL);
+    atomic_init(&log->committed, 0);
+    atomic_init(&log->epoch, 0);
+    atomic_init(&log->pins[0], 0);
+    atomic_init(&log->pins[1], 0);
+    log->fd = -1;
+    log->dir_fd = -1;
+}
+
+int datalog_open(struct datalog *log, const char *path)
+{
+    datalog_init(log);
+    log->segment_size = DATALOG_SEGMENT_SIZE;
+    // Written at explicit offsets (pwritev()), so an io_uring write may be queued ahead of its bytes
+    log->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log->fd == -1)
+        return -1;
+    return 0;
+}
+
+static void datalog_segment_name(char *name, size_t size, size_t base, const char *suffix)
+{
+    snprintf(name, size, "%0*zu.%s", DATALOG_NAME_DIGITS, base, suffix);
+}
+
+static void datalog_segment_free(struct datalog *log, struct datalog_segment *seg)
+{
+    if (log->dir_fd != -1) {
+        munmap(seg->data, seg->size);
+        if (seg->index_fd != -1)
+            close(seg->index_fd);
+    }
+    free(seg);
+}
+
+static void datalog_free_retired(struct datalog *log, struct datalog_segment *seg)
+{
+    while (seg) {
+        struct datalog_segment *retired = seg->retired;
+        datalog_segment_free(log, seg);
+        seg = retired;
+    }
+}
+
+void datalog_close(struct datalog *log)
+{
+    struct datalog_segment *seg = atomic_load_explicit(&log->head, memory_order_relaxed);
+    while (seg) {
+        struct datalog_segment *next = seg->next;
+        datalog_segment_free(log, seg);
+        seg = next;
+    }
+    datalog_free_retired(log, log->retired_current);
+    datalog_free_retired(log, log->retired_previous);
+    free(log->record_ends);
+    if (log->fd != -1)
+        close(log->fd);
+    if (log->dir_fd != -1)
+        close(log->dir_fd);
+    datalog_init(log);
+}
+
+void datalog_freeze(struct datalog *log)
+{
+    log->frozen = true;
+}
+
+void datalog_fail(struct datalog *log)
+{
+    log->failed = true;
+}
+
+// Link @param seg as the new tail, before any length covering it is published
+static void datalog_link(struct datalog *log, struct datalog_segment *seg)
+{
+    if (log->tail)
+        log->tail->next = seg;
+    else
+        atomic_store_explicit(&log->head, seg, memory_order_release);
+    log->tail = seg;
+}
+
+// Create and map the segment file for bytes from @param base, with an empty index
+static struct datalog_segment *datalog_segment_create(struct datalog *log, size_t base)
+{
+    char name[DATALOG_NAME_DIGITS + 8];
+    struct datalog_segment *seg = calloc(1, sizeof(*seg));
+    if (!seg) {
+        syslog(LOG_ERR, "Memory allocation failed");
+        return NULL;
+    }
+    seg->base = base;
+    seg->size = log->segment_size;
+
+    // The file is sized up front so the whole mapping is backed; the index tells what is data
+    datalog_segment_name(name, sizeof(name), base, "log");
+    int fd = openat(log->dir_fd, name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || ftruncate(fd, seg->size) == -1) {
+        syslog(LOG_ERR, "Failed to create segment %s: %s", name, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        free(seg);
+        return NULL;
+    }
+    seg->data = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg->data == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to map segment %s: %s", name, strerror(errno));
+        free(seg);
+        return NULL;
+    }
+
+    datalog_segment_name(name, sizeof(name), base, "idx");
+    seg->index_fd = openat(log->dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (seg->index_fd == -1) {
+        syslog(LOG_ERR, "Failed to create segment index %s: %s", name, strerror(errno));
+        munmap(seg->data, seg->size);
+        free(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+// Make a full segment file read-only and close its index: it will not change again
+static void datalog_seal(struct datalog_segment *seg)
+{
+    mprotect(seg->data, seg->size, PROT_READ);
+    close(seg->index_fd);
+    seg->index_fd = -1;
+    seg->sealed = time(NULL);
+}
+
+static void datalog_unlink_segment(struct datalog *log, size_t base)
+{
+    char name[DATALOG_NAME_DIGITS + 8];
+
+    datalog_segment_name(name, sizeof(name), base, "log");
+    if (unlinkat(log->dir_fd, name, 0) == -1 && errno != ENOENT)
+        syslog(LOG_ERR, "Failed to remove segment %s: %s", name, strerror(errno));
+    datalog_segment_name(name, sizeof(name), base, "idx");
+    if (unlinkat(log->dir_fd, name, 0) == -1 && errno != ENOENT)
+        syslog(LOG_ERR, "Failed to remove segment index %s: %s", name, strerror(errno));
+}
+
+// Write every record at the end of the log with as few pwritev() calls as IOV_MAX allows,
+// resuming after short writes
+static int datalog_write_file(struct datalog *log, const struct datalog_record *records,
+                              unsigned int count)
+{
+    struct iovec iov[DATALOG_WRITE_IOV];
+    off_t offset = log->length;
+    unsigned int rec = 0, buf = 0; // Next buffer to write is records[rec].iov[buf]
+    size_t skip = 0;               // Bytes of that buffer already written
+
+    while (rec < count) {
+        int iovcnt = 0;
+        for (unsigned int r = rec, b = buf; r < count && iovcnt < DATALOG_WRITE_IOV; r++, b = 0) {
+            for (; b < records[r].iovcnt && iovcnt < DATALOG_WRITE_IOV; b++) {
+                size_t offset = r == rec && b == buf ? skip : 0;
+                iov[iovcnt].iov_base = (char *)records[r].iov[b].iov_base + offset;
+                iov[iovcnt].iov_len = records[r].iov[b].iov_len - offset;
+                iovcnt++;
+            }
+        }
+        if (iovcnt == 0)
+            break; // Only empty records left
+
+        ssize_t n = pwritev(log->fd, iov, iovcnt, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Failed to write data file: %s", strerror(errno));
+            return -1;
+        }
+        offset += n;
+
+        size_t written = n + skip;
+        while (rec < count) {
+            if (buf == records[rec].iovcnt) {
+                rec++;
+                buf = 0;
+                continue;
+            }
+            if (written < records[rec].iov[buf].iov_len)
+                break;
+            written -= records[rec].iov[buf].iov_len;
+            buf++;
+        }
+        skip = written;
+    }
+
+    if (log->sync && fdatasync(log->fd) == -1) {
+        syslog(LOG_ERR, "Failed to sync data file: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int datalog_copy_in(struct datalog *log, const char *data, size_t len)
+{
+    while (len > 0) {
+        struct datalog_segment *seg = log->tail;
+        if (!seg || seg->used == seg->size) {
+            if (log->dir_fd != -1) {
+                seg = datalog_segment_create(log, log->length);
+                if (!seg)
+                    return -1;
+            } else {
+                seg = calloc(1, sizeof(*seg) + DATALOG_SEGMENT_SIZE);
+                if (!seg) {
+                    syslog(LOG_ERR, "Memory allocation failed");
+                    return -1;
+                }
+                seg->base = log->length;
+                seg->size = DATALOG_SEGMENT_SIZE;
+                seg->data = (char *)(seg + 1);
+                seg->index_fd = -1;
+            }
+            datalog_link(log, seg);
+        }
+
+        size_t chunk = seg->size - seg->used;
+        if (chunk > len)
+            chunk = len;
+        memcpy(seg->data + seg->used, data, chunk);
+        seg->used += chunk;
+        log->length += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+int datalog_adopt(struct datalog *log, int fd, size_t length)
+{
+    char buf[DATALOG_SEGMENT_SIZE];
+
+    datalog_init(log);
+    log->segment_size = DATALOG_SEGMENT_SIZE;
+    log->fd = fd;
+    while (log->length < length) {
+        size_t want = length - log->length < sizeof(buf) ? length - log->length : sizeof(buf);
+        ssize_t n = pread(fd, buf, want, log->length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            syslog(LOG_ERR, "Failed to read back data file at %zu of %zu bytes: %s", log->length, length,
+                   n < 0 ? strerror(errno) : "file too short");
+            datalog_close(log);
+            return -1;
+        }
+        if (datalog_copy_in(log, buf, n) < 0) {
+            datalog_close(log);
+            return -1;
+        }
+    }
+
+    if (length > 0) {
+        log->record_ends = malloc(sizeof(*log->record_ends));
+        if (!log->record_ends) {
+            syslog(LOG_ERR, "Memory allocation failed");
+            datalog_close(log);
+            return -1;
+        }
+        log->record_ends[0] = length;
+        log->record_count = log->record_capacity = 1;
+    }
+    atomic_store_explicit(&log->committed, log->length, memory_order_release);
+    return 0;
+}
+
+// Write the index entries of the records appended since record @param first, whose bytes start in @param seg
+static int datalog_write_index(struct datalog *log, struct datalog_segment *seg, size_t first)
+{
+    datalog_index_entry entries[DATALOG_INDEX_BATCH];
+    size_t i = first;
+
+    while (i < log->record_count) {
+        // A record belongs to the segment holding its last byte (an empty one, to where it starts)
+        while (log->record_ends[i] > seg->base + seg->size)
+            seg = seg->next;
+        unsigned int n = 0;
+        while (i < log->record_count && n < DATALOG_INDEX_BATCH &&
+               log->record_ends[i] <= seg->base + seg->size)
+            entries[n++] = log->record_ends[i++];
+        if (write(seg->index_fd, entries, n * sizeof(entries[0])) != (ssize_t)(n * sizeof(entries[0]))) {
+            syslog(LOG_ERR, "Failed to write segment index: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Flush the bytes from @param start (in @param seg onwards) to their segment files, and the
+ * index entries written since, before the append is published (-f).
+ */
+static int datalog_sync_segments(struct datalog_segment *seg, size_t start)
+{
+    long page = sysconf(_SC_PAGESIZE);
+
+    for (; seg; seg = seg->next) {
+        size_t from = start > seg->base ? start - seg->base : 0;
+        size_t aligned = from - from % page;
+        if (seg->used > from && msync(seg->data + aligned, seg->used - aligned, MS_SYNC) == -1) {
+            syslog(LOG_ERR, "Failed to sync segment: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int datalog_sync_index(struct datalog_segment *seg)
+{
+    for (; seg; seg = seg->next) {
+        if (seg->index_fd != -1 && fdatasync(seg->index_fd) == -1) {
+            syslog(LOG_ERR, "Failed to sync segment index: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Free the segments dropped by retention once no reader can still be using them
+static void datalog_reclaim(struct datalog *log)
+{
+    for (int pass = 0; pass < 2; pass++) {
+        if (!log->retired_current && !log->retired_previous)
+            return;
+        unsigned int epoch = atomic_load(&log->epoch);
+        // Readers that pinned during the previous epoch could still reach retired_previous;
+        // their counter is the one the next epoch will use
+        if (atomic_load(&log->pins[(epoch + 1) & 1]) != 0)
+            return;
+        datalog_free_retired(log, log->retired_previous);
+        log->retired_previous = log->retired_current;
+        log->retired_current = NULL;
+        atomic_store(&log->epoch, epoch + 1);
+    }
+}
+
+// Drop the oldest sealed segments beyond the byte or age limit
+static void datalog_retain(struct datalog *log)
+{
+    time_t now = time(NULL);
+
+    while (1) {
+        struct datalog_segment *seg = atomic_load_explicit(&log->head, memory_order_relaxed);
+        if (!seg || seg == log->tail || !seg->sealed)
+            break;
+        if (!(log->retain_bytes && log->length - seg->base > log->retain_bytes) &&
+            !(log->retain_seconds && now - seg->sealed > log->retain_seconds))
+            break;
+
+        datalog_unlink_segment(log, seg->base);
+        // New readers start from the next segment; those already past the head keep seg->next
+        atomic_store(&log->head, seg->next);
+
+        size_t dropped = 0;
+        while (dropped < log->record_count && log->record_ends[dropped] <= seg->next->base)
+            dropped++;
+        log->record_count -= dropped;
+        memmove(log->record_ends, log->record_ends + dropped, log->record_count * sizeof(*log->record_ends));
+
+        seg->retired = log->retired_current;
+        log->retired_current = seg;
+    }
+    datalog_reclaim(log);
+}
+
+// Append to the in-memory log (and segment files), writing a single data file only if @param write_file
+static int datalog_append_records(struct datalog *log, const struct datalog_record *records,
+                                  unsigned int count, size_t *ends, bool write_file)
+{
+    if (count == 0)
+        return 0;
+    if (log->frozen) {
+        syslog(LOG_ERR, "Data log was handed to another instance, append refused");
+        return -1;
+    }
+    if (log->failed) {
+        syslog(LOG_ERR, "Data log is inconsistent after a failed append, append refused");
+        return -1;
+    }
+
+    if (log->record_count + count > log->record_capacity) {
+        size_t capacity = log->record_capacity ? log->record_capacity : 256;
+        while (capacity < log->record_count + count)
+            capacity *= 2;
+        size_t *record_ends = realloc(log->record_ends, capacity * sizeof(*record_ends));
+        if (!record_ends) {
+            syslog(LOG_ERR, "Memory allocation failed");
+            return -1;
+        }
+        log->record_ends = record_ends;
+        log->record_capacity = capacity;
+    }
+
+    // A single data file is written first; segment files are the segments themselves
+    if (log->dir_fd == -1 && write_file && datalog_write_file(log, records, count) < 0)
+        return -1;
+
+    size_t start = log->length;
+    size_t first = log->record_count;
+    struct datalog_segment *start_seg = log->tail; // Where the batch starts, possibly full
+
+    for (unsigned int i = 0; i < count; i++) {
+        for (unsigned int b = 0; b < records[i].iovcnt; b++) {
+            if (datalog_copy_in(log, records[i].iov[b].iov_base, records[i].iov[b].iov_len) < 0)
+                goto failed;
+        }
+        log->record_ends[log->record_count++] = log->length;
+        if (ends)
+            ends[i] = log->length;
+    }
+
+    if (!start_seg)
+        start_seg = atomic_load_explicit(&log->head, memory_order_relaxed);
+    if (log->dir_fd != -1 && start_seg) {
+        // The data must be durable before the index entries that cover it
+        if (log->sync && datalog_sync_segments(start_seg, start) < 0)
+            goto failed;
+        if (datalog_write_index(log, start_seg, first) < 0)
+            goto failed;
+        if (log->sync && datalog_sync_index(start_seg) < 0)
+            goto failed;
+        // Segments filled by this batch (or by the last one, if it ended on a boundary)
+        for (struct datalog_segment *seg = start_seg; seg != log->tail; seg = seg->next)
+            datalog_seal(seg);
+    }
+
+    // Publish the records: everything written above happens-before a reader's acquire load
+    atomic_store_explicit(&log->committed, log->length, memory_order_release);
+
+    if (log->retain_bytes || log->retain_seconds)
+        datalog_retain(log);
+    return 0;
+
+failed:
+    // Part of the batch is already in the log (and the file), and the next append would
+    // publish it: refuse every further append instead
+    log->failed = true;
+    return -1;
+}
+
+int datalog_appendv(struct datalog *log, const struct datalog_record *records, unsigned int count,
+                    size_t *ends)
+{
+    return datalog_append_records(log, records, count, ends, true);
+}
+
+int datalog_appendv_deferred(struct datalog *log, const struct datalog_record *records,
+                             unsigned int count, size_t *ends, size_t *offset)
+{
+    *offset = log->length;
+    return datalog_append_records(log, records, count, ends, false);
+}
+
+// @return true if @param name is "<base>.<suffix>", with the base stored in @param base
+static bool datalog_parse_name(const char *name, const char *suffix, size_t *base)
+{
+    size_t value = 0;
+
+    for (int i = 0; i < DATALOG_NAME_DIGITS; i++) {
+        if (name[i] < '0' || name[i] > '9')
+            return false;
+        value = value * 10 + (name[i] - '0');
+    }
+    if (name[DATALOG_NAME_DIGITS] != '.' || strcmp(name + DATALOG_NAME_DIGITS + 1, suffix) != 0)
+        return false;
+    *base = value;
+    return true;
+}
+
+static int datalog_compare_base(const void *a, const void *b)
+{
+    size_t x = *(const size_t *)a, y = *(const size_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Collect the bases of the segment files in the directory, in order.
+ * @return the number found, with *@param bases to free(), or -1 on failure.
+ */
+static ssize_t datalog_list_segments(struct datalog *log, size_t **bases)
+{
+    int fd = dup(log->dir_fd);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    size_t count = 0, capacity = 0;
+    struct dirent *ent;
+
+    *bases = NULL;
+    if (!dir) {
+        syslog(LOG_ERR, "Failed to read segment directory: %s", strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        size_t base;
+        if (!datalog_parse_name(ent->d_name, "log", &base))
+            continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            size_t *grown = realloc(*bases, capacity * sizeof(*grown));
+            if (!grown) {
+                syslog(LOG_ERR, "Memory allocation failed");
+                free(*bases);
+                closedir(dir);
+                return -1;
+            }
+            *bases = grown;
+        }
+        (*bases)[count++] = base;
+    }
+    closedir(dir);
+    if (count > 1)
+        qsort(*bases, count, sizeof(**bases), datalog_compare_base);
+    return count;
+}
+
+/**
+ * Map the existing segment file at @param base and add its index entries to the record
+ * index, keeping the entries that follow on from the log so far.  @param complete is
+ * cleared if an entry did not, or could not be kept: the log ends in this segment.
+ * @return the segment, or NULL if it is missing or unreadable.
+ */
+static struct datalog_segment *datalog_segment_load(struct datalog *log, size_t base, bool *complete)
+{
+    char name[DATALOG_NAME_DIGITS + 8];
+    struct stat st;
+
+    datalog_segment_name(name, sizeof(name), base, "log");
+    int fd = openat(log->dir_fd, name, O_RDWR | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0) {
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    struct datalog_segment *seg = calloc(1, sizeof(*seg));
+    if (!seg) {
+        close(fd);
+        return NULL;
+    }
+    seg->base = base;
+    seg->size = st.st_size;
+    seg->index_fd = -1;
+    seg->sealed = st.st_mtime;
+    seg->data = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg->data == MAP_FAILED) {
+        syslog(LOG_ERR, "Failed to map segment %s: %s", name, strerror(errno));
+        free(seg);
+        return NULL;
+    }
+
+    datalog_segment_name(name, sizeof(name), base, "idx");
+    fd = openat(log->dir_fd, name, O_RDONLY | O_CLOEXEC);
+    datalog_index_entry entries[DATALOG_INDEX_BATCH];
+    ssize_t n;
+    while (fd != -1 && (n = read(fd, entries, sizeof(entries))) > 0) {
+        for (ssize_t i = 0; i < n / (ssize_t)sizeof(entries[0]); i++) {
+            size_t end = entries[i];
+            size_t prev = log->record_count ? log->record_ends[log->record_count - 1] : base;
+            if (end < prev || end < base || end > base + seg->size) {
+                *complete = false; // Torn or stale entry: the log ends before it
+                goto done;
+            }
+            if (log->record_count == log->record_capacity) {
+                size_t capacity = log->record_capacity ? log->record_capacity * 2 : 256;
+                size_t *record_ends = realloc(log->record_ends, capacity * sizeof(*record_ends));
+                if (!record_ends) {
+                    *complete = false;
+                    goto done;
+                }
+                log->record_ends = record_ends;
+                log->record_capacity = capacity;
+            }
+            log->record_ends[log->record_count++] = end;
+        }
+    }
+done:
+    if (fd != -1)
+        close(fd);
+    return seg;
+}
+
+// Continue the log from the segment files in the directory, see datalog_open_dir()
+static int datalog_recover(struct datalog *log)
+{
+    size_t *bases;
+    ssize_t count = datalog_list_segments(log, &bases);
+    if (count < 0)
+        return -1;
+
+    bool complete = true;
+    for (ssize_t i = 0; i < count && complete; i++) {
+        // Segments must follow on from each other; anything after a gap is dropped
+        if (log->tail && bases[i] != log->tail->base + log->tail->size)
+            break;
+        struct datalog_segment *seg = datalog_segment_load(log, bases[i], &complete);
+        if (!seg)
+            break;
+        datalog_link(log, seg);
+    }
+
+    // The log ends with the last indexed record; bytes after it were never acknowledged
+    struct datalog_segment *head = atomic_load_explicit(&log->head, memory_order_relaxed);
+    log->length = log->record_count ? log->record_ends[log->record_count - 1] : 0;
+    struct datalog_segment *keep = NULL, *seg = head;
+    while (seg && log->record_count && seg->base < log->length) {
+        keep = seg;
+        seg = seg->next;
+    }
+
+    // Cut off the segments past the end, and any that could not be loaded
+    if (keep) {
+        keep->next = NULL;
+        log->tail = keep;
+    } else {
+        atomic_store_explicit(&log->head, NULL, memory_order_relaxed);
+        log->tail = NULL;
+        log->length = 0;
+        log->record_count = 0;
+    }
+    while (seg) {
+        struct datalog_segment *next = seg->next;
+        datalog_segment_free(log, seg);
+        seg = next;
+    }
+    for (ssize_t j = 0; j < count; j++) {
+        if (!log->tail || bases[j] > log->tail->base)
+            datalog_unlink_segment(log, bases[j]);
+    }
+    free(bases);
+    if (!log->tail)
+        return 0;
+
+    // Every segment but the tail is full and sealed; the tail takes further appends
+    unsigned int segments = 1;
+    for (seg = atomic_load_explicit(&log->head, memory_order_relaxed); seg != log->tail; seg = seg->next) {
+        seg->used = seg->size;
+        mprotect(seg->data, seg->size, PROT_READ);
+        segments++;
+    }
+    struct datalog_segment *tail = log->tail;
+    char name[DATALOG_NAME_DIGITS + 8];
+    size_t tail_records = 0;
+    while (tail_records < log->record_count &&
+           log->record_ends[log->record_count - 1 - tail_records] > tail->base)
+        tail_records++;
+    tail->used = log->length - tail->base;
+    tail->sealed = 0;
+    datalog_segment_name(name, sizeof(name), tail->base, "idx");
+    tail->index_fd = openat(log->dir_fd, name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (tail->index_fd == -1 || ftruncate(tail->index_fd, tail_records * sizeof(datalog_index_entry)) == -1) {
+        syslog(LOG_ERR, "Failed to reopen segment index %s: %s", name, strerror(errno));
+        return -1;
+    }
+
+    atomic_store_explicit(&log->committed, log->length, memory_order_release);
+    syslog(LOG_INFO, "Recovered %zu records (%zu bytes) from %u segments", log->record_count,
+           log->length - atomic_load_explicit(&log->head, memory_order_relaxed)->base, segments);
+    return 0;
+}
+
+int datalog_open_dir(struct datalog *log, const struct datalog_options *opts)
+{
+    datalog_init(log);
+    log->segment_size = opts->segment_size;
+    log->retain_bytes = opts->retain_bytes;
+    log->retain_seconds = opts->retain_seconds;
+
+    if (mkdir(opts->dir, 0755) == -1 && errno != EEXIST) {
+        syslog(LOG_ERR, "Failed to create segment directory %s: %s", opts->dir, strerror(errno));
+        return -1;
+    }
+    log->dir_fd = open(opts->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (log->dir_fd == -1) {
+        syslog(LOG_ERR, "Failed to open segment directory %s: %s", opts->dir, strerror(errno));
+        return -1;
+    }
+
+    if (opts->recover) {
+        if (datalog_recover(log) < 0) {
+            datalog_close(log);
+            return -1;
+        }
+        if (log->retain_bytes || log->retain_seconds)
+            datalog_retain(log);
+        return 0;
+    }
+
+    // Start empty, as the single data file is truncated
+    size_t *bases;
+    ssize_t count = datalog_list_segments(log, &bases);
+    if (count < 0) {
+        datalog_close(log);
+        return -1;
+    }
+    for (ssize_t i = 0; i < count; i++)
+        datalog_unlink_segment(log, bases[i]);
+    free(bases);
+    return 0;
+}
+
+int datalog_append(struct datalog *log, const void *data, size_t len)
+{
+    struct iovec iov = { .iov_base = (void *)data, .iov_len = len };
+    struct datalog_record record = { .iov = &iov, .iovcnt = 1 };
+
+    if (len == 0)
+        return 0;
+    return datalog_appendv(log, &record, 1, NULL);
+}
+
+size_t datalog_length(const struct datalog *log)
+{
+    return atomic_load_explicit(&((struct datalog *)log)->committed, memory_order_acquire);
+}
+
+size_t datalog_record_count(const struct datalog *log)
+{
+    return log->record_count;
+}
+
+size_t datalog_record_end(const struct datalog *log, size_t index)
+{
+    return index < log->record_count ? log->record_ends[index] : log->length;
+}
+
+unsigned int datalog_pin(struct datalog *log)
+{
+    if (!log->retain_bytes && !log->retain_seconds)
+        return 0;
+
+    // Counted before the head is read, so datalog_reclaim() sees this reader in time
+    unsigned int pin = atomic_load(&log->epoch) & 1;
+    atomic_fetch_add(&log->pins[pin], 1);
+    return pin;
+}
+
+void datalog_unpin(struct datalog *log, unsigned int pin)
+{
+    if (log->retain_bytes || log->retain_seconds)
+        atomic_fetch_sub(&log->pins[pin], 1);
+}
+
+void datalog_cursor_init(const struct datalog *log, struct datalog_cursor *cursor)
+{
+    struct datalog_segment *head = atomic_load_explicit(&((struct datalog *)log)->head, memory_order_acquire);
+
+    cursor->seg = head;
+    cursor->offset = head ? head->base : 0;
+}
+
+int datalog_fill_iov(const struct datalog *log, const struct datalog_cursor *cursor, size_t end,
+                     struct iovec *iov, int max_iov)
+{
+    int iovcnt = 0;
+    size_t offset = cursor->offset;
+
+    if (offset >= end)
+        return 0;
+
+    // head is only guaranteed visible once a non-zero committed length has been observed
+    struct datalog_segment *seg = cursor->seg ? cursor->seg :
+        atomic_load_explicit(&((struct datalog *)log)->head, memory_order_acquire);
+
+    while (seg && offset < end && iovcnt < max_iov) {
+        size_t seg_end = seg->base + seg->size;
+        if (offset >= seg_end) {
+            seg = seg->next;
+            continue;
+        }
+        size_t stop = seg_end < end ? seg_end : end;
+        iov[iovcnt].iov_base = seg->data + (offset - seg->base);
+        iov[iovcnt].iov_len = stop - offset;
+        iovcnt++;
+        offset = stop;
+    }
+    return iovcnt;
+}
+
+void datalog_cursor_advance(const struct datalog *log, struct datalog_cursor *cursor, size_t count,
+                            size_t end)
+{
+    size_t offset = cursor->offset + count;
+    struct datalog_segment *seg = cursor->seg ? cursor->seg :
+        atomic_load_explicit(&((struct datalog *)log)->head, memory_order_acquire);
+
+    // Keep the cursor on the segment holding the next unsent byte
+    while (offset < end && offset >= seg->base + seg->size)
+        seg = seg->next;
+    cursor->seg = seg;
+    cursor->offset = offset;
+}
+
+ssize_t datalog_send(const struct datalog *log, struct datalog_cursor *cursor, size_t end,
+                     int sockfd, int flags)
+{
+    struct iovec iov[DATALOG_SEND_IOV];
+    int iovcnt = datalog_fill_iov(log, cursor, end, iov, DATALOG_SEND_IOV);
+
+    if (iovcnt == 0)
+        return 0;
+
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    ssize_t sent = sendmsg(sockfd, &msg, flags);
+    if (sent > 0)
+        datalog_cursor_advance(log, cursor, sent, end);
+    return sent;
+}
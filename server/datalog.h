@@ -0,0 +1,200 @@
+#ifndef DATALOG_H
+#define DATALOG_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define DATALOG_SEGMENT_SIZE (64 * 1024)
+
+/**
+ * A fixed-size chunk of the log.  Segments are only ever appended to the chain, so a byte
+ * at a given offset never moves once written.  In memory the data follows the struct; on
+ * disk it is the mmap() of one segment file, read-only once the segment is sealed.
+ */
+struct datalog_segment {
+    struct datalog_segment *next;
+    size_t base;  // Offset of data[0] within the log
+    size_t size;  // Capacity of data[]
+    size_t used;  // Bytes of data[] in use, only touched by appenders
+    char *data;
+    int index_fd; // Segment file only: record index, -1 once sealed
+    time_t sealed; // Segment file only: when it filled up, 0 while it is the tail
+    struct datalog_segment *retired; // Link in a list of segments dropped by retention
+};
+
+/**
+ * On-disk layout for datalog_open_dir().  The log is kept in segment files of
+ * segment_size bytes named after the log offset of their first byte (<base>.log),
+ * each with an index of the end offsets of the records that end in it (<base>.idx,
+ * native 64-bit integers).  The index, not the file size, tells how much of a segment
+ * holds data.
+ */
+struct datalog_options {
+    const char *dir;
+    size_t segment_size;
+    size_t retain_bytes;  // Drop the oldest sealed segments while the log holds more, 0 for no limit
+    long retain_seconds;  // Drop sealed segments that filled up longer ago, 0 for no limit
+    bool recover;         // Continue the log found in dir instead of starting empty
+};
+
+/**
+ * In-memory, segmented mirror of the append-only data file.
+ * Appends go to the file and to the segment chain; the file is only read back by
+ * sendfile() on the zero-copy echo path.
+ * Each append is one record, and the end offset of every record is kept in an index.
+ *
+ * Appenders must be serialized by the caller (file_mutex), and so must readers of the
+ * record index.  Readers of the data itself take no lock: an append first writes the
+ * file and fills (and links) segments, then publishes the new committed length with a
+ * release store.  A reader that loads the committed length with acquire semantics may
+ * stream every byte below it, from either the file or the segments, while later
+ * appends proceed, because published bytes are never modified or moved.
+ *
+ * Opened with datalog_open_dir(), the segments are the data files themselves (there is no
+ * single data file), and retention may drop the oldest ones.  Readers then pin the log
+ * (datalog_pin()) for as long as they hold a cursor: a dropped segment is unlinked at once
+ * but only unmapped once every reader that could have reached it has unpinned.
+ */
+struct datalog {
+    int fd;                         // Data file, written at explicit offsets; -1 for a segment directory
+    _Atomic(struct datalog_segment *) head; // Oldest retained segment
+    struct datalog_segment *tail;
+    size_t length;                  // Bytes appended so far, only touched by appenders
+    atomic_size_t committed;        // Bytes readers may access, published after each append
+    size_t *record_ends;            // record_ends[i] is the offset just past retained record i
+    size_t record_count;
+    size_t record_capacity;
+    bool sync;                      // fdatasync() the file before publishing each append
+    bool frozen;                    // Appends fail, see datalog_freeze()
+    bool failed;                    // Appends fail, see datalog_fail()
+
+    int dir_fd;                     // Segment directory, -1 for a single data file
+    size_t segment_size;
+    size_t retain_bytes;
+    long retain_seconds;
+    // Reclamation of dropped segments: readers count themselves in pins[epoch & 1]
+    atomic_uint epoch;
+    atomic_long pins[2];
+    struct datalog_segment *retired_current;  // Dropped during the current epoch
+    struct datalog_segment *retired_previous; // Dropped during the previous epoch
+};
+
+/**
+ * One record to append, gathered from @param iovcnt buffers (a packet received into
+ * several slabs, for example).
+ */
+struct datalog_record {
+    const struct iovec *iov;
+    unsigned int iovcnt;
+};
+
+/**
+ * Position of a reader within the log.  Initialize with datalog_cursor_init() and only
+ * move it forward with datalog_send().
+ */
+struct datalog_cursor {
+    struct datalog_segment *seg;
+    size_t offset;
+};
+
+// Create (truncating) the data file at @param path and an empty log mirroring it
+int datalog_open(struct datalog *log, const char *path);
+
+/**
+ * Open a log kept as segment files in @param opts->dir, creating the directory if needed.
+ * Unless @param opts->recover is set, segment files already there are deleted.  When it is,
+ * the log continues from them: a record that was not completely written and indexed is cut
+ * off, then retention applies.  The files are kept by datalog_close().
+ * @return 0 on success, -1 on failure (logged).
+ */
+int datalog_open_dir(struct datalog *log, const struct datalog_options *opts);
+
+/**
+ * Continue the log kept in the data file @param fd by a previous instance (a hot restart,
+ * see handoff.h): its first @param length bytes are read back into memory as one record,
+ * and appends go on from there.  The log takes ownership of @param fd, even on failure.
+ * @return 0 on success, -1 on failure (logged).
+ */
+int datalog_adopt(struct datalog *log, int fd, size_t length);
+
+void datalog_close(struct datalog *log);
+
+// Make every further append fail, so the length can be handed on.  Caller must hold file_mutex.
+void datalog_freeze(struct datalog *log);
+
+/**
+ * A deferred data file write (see datalog_appendv_deferred()) failed, so the file no longer
+ * matches the log: make every further append fail rather than write past the hole.
+ * An append that fails after taking in part of its records does the same by itself.
+ * Caller must hold file_mutex.
+ */
+void datalog_fail(struct datalog *log);
+
+/**
+ * Append @param len bytes as a new record to both the data file and the in-memory log,
+ * then publish it to readers.  Caller must hold file_mutex.
+ */
+int datalog_append(struct datalog *log, const void *data, size_t len);
+
+/**
+ * Append @param count records with a single writev() (per IOV_MAX buffers) to the data
+ * file, then to the in-memory log, and publish them together.  If @param ends is not NULL,
+ * ends[i] receives the log length just past records[i].  Caller must hold file_mutex.
+ */
+int datalog_appendv(struct datalog *log, const struct datalog_record *records, unsigned int count,
+                    size_t *ends);
+
+/**
+ * Like datalog_appendv(), but leave writing a single data file to the caller: the records
+ * are published from memory at once, and belong at file offset *@param offset onwards
+ * (io_uring queues that write itself).  Segment files are written as usual.
+ */
+int datalog_appendv_deferred(struct datalog *log, const struct datalog_record *records,
+                             unsigned int count, size_t *ends, size_t *offset);
+
+// @return the committed length.  Safe to call without any lock.
+size_t datalog_length(const struct datalog *log);
+
+size_t datalog_record_count(const struct datalog *log);
+
+// @return the offset just past record @param index
+size_t datalog_record_end(const struct datalog *log, size_t index);
+
+/**
+ * Keep every segment reachable from the log head as of now mapped until the matching
+ * datalog_unpin().  Readers hold a pin while they use a cursor; it is a no-op for logs
+ * that never drop segments.  @return the token to pass to datalog_unpin().
+ */
+unsigned int datalog_pin(struct datalog *log);
+
+void datalog_unpin(struct datalog *log, unsigned int pin);
+
+// Position @param cursor at the oldest retained byte
+void datalog_cursor_init(const struct datalog *log, struct datalog_cursor *cursor);
+
+/**
+ * Describe log bytes from @param cursor up to @param end with at most @param max_iov
+ * entries of @param iov, one per segment touched.  The cursor is not moved.
+ * @return the number of entries filled.
+ */
+int datalog_fill_iov(const struct datalog *log, const struct datalog_cursor *cursor, size_t end,
+                     struct iovec *iov, int max_iov);
+
+// Move @param cursor forward by @param count bytes, which must not pass @param end
+void datalog_cursor_advance(const struct datalog *log, struct datalog_cursor *cursor, size_t count,
+                            size_t end);
+
+/**
+ * Send log bytes from @param cursor up to @param end on socket @param sockfd with a single
+ * sendmsg() spanning as many segments as fit, advancing the cursor by the amount sent.
+ * Runs without any lock; @param end must be a length previously read from datalog_length().
+ * @return bytes sent, or -1 with errno set by sendmsg().
+ */
+ssize_t datalog_send(const struct datalog *log, struct datalog_cursor *cursor, size_t end,
+                     int sockfd, int flags);
+
+#endif /* DATALOG_H */
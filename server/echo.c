@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "aesdsocket.h"
+#include "echo.h"
+#include "metrics.h"
+
+#define ECHO_QUEUE_IOV 64 // iovec entries gathered into one sendmsg() for a backlog of echoes
+
+// Cleared the first time sendfile() is refused so later echoes go straight to the copy path
+static atomic_bool sendfile_supported = true;
+
+// Start @param echo at @param start, which @param pin keeps readable
+static void echo_begin_at(struct echo *echo, const struct datalog_cursor *start, unsigned int pin,
+                          size_t end, bool allow_zero_copy)
+{
+    echo->pin = pin;
+    echo->pinned = true;
+    echo->cursor = *start;
+    echo->end = end;
+    echo->zero_copy = allow_zero_copy && config.zero_copy && data_log.fd != -1 &&
+                      atomic_load_explicit(&sendfile_supported, memory_order_relaxed);
+    if (echo->zero_copy)
+        atomic_fetch_add_explicit(&stats.echo_sendfile, 1, memory_order_relaxed);
+    else
+        atomic_fetch_add_explicit(&stats.echo_copy, 1, memory_order_relaxed);
+}
+
+static void echo_begin(struct echo *echo, size_t end, bool allow_zero_copy)
+{
+    struct datalog_cursor start;
+    unsigned int pin = datalog_pin(&data_log);
+
+    datalog_cursor_init(&data_log, &start);
+    echo_begin_at(echo, &start, pin, end, allow_zero_copy);
+}
+
+void echo_start(struct echo *echo, size_t end)
+{
+    echo_begin(echo, end, true);
+}
+
+void echo_finish(struct echo *echo)
+{
+    if (echo->pinned) {
+        datalog_unpin(&data_log, echo->pin);
+        echo->pinned = false;
+    }
+}
+
+ssize_t echo_send(struct echo *echo, int sockfd, int flags)
+{
+    if (echo->zero_copy) {
+        off_t offset = echo->cursor.offset;
+        size_t count = echo->end - echo->cursor.offset;
+        ssize_t sent = sendfile(sockfd, data_log.fd, &offset, count);
+        if (sent > 0) {
+            echo->cursor.offset = offset;
+            metrics_count(COUNTER_BYTES_ECHOED, sent);
+            return sent;
+        }
+        if (sent < 0 && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+            return sent;
+
+        if (sent < 0) {
+            syslog(LOG_WARNING, "sendfile refused (%s), falling back to copying echoes", strerror(errno));
+            atomic_store_explicit(&sendfile_supported, false, memory_order_relaxed);
+        } else {
+            // The file ends before the committed length: copy this echo from memory, which has it
+            syslog(LOG_WARNING, "Data file shorter than the log, copying this echo");
+        }
+        atomic_fetch_add_explicit(&stats.sendfile_fallback, 1, memory_order_relaxed);
+        echo->zero_copy = false;
+    }
+    ssize_t sent = datalog_send(&data_log, &echo->cursor, echo->end, sockfd, flags);
+    if (sent > 0)
+        metrics_count(COUNTER_BYTES_ECHOED, sent);
+    return sent;
+}
+
+void echo_queue_init(struct echo_queue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+}
+
+void echo_queue_release(struct echo_queue *queue)
+{
+    if (queue->count > 0)
+        echo_finish(&queue->current);
+    for (unsigned int i = 1; i <= queue->started; i++)
+        datalog_unpin(&data_log, queue->start_pins[(queue->head + i) % ECHO_QUEUE_DEPTH]);
+    queue->count = 0;
+    queue->started = 0;
+}
+
+void echo_queue_push(struct echo_queue *queue, size_t end)
+{
+    unsigned int tail = (queue->head + queue->count) % ECHO_QUEUE_DEPTH;
+    queue->ends[tail] = end;
+    queue->queued_ns[tail] = metrics_now();
+    if (queue->count++ == 0)
+        echo_begin(&queue->current, end, true);
+}
+
+// Retire the echo at the head and start the next one, if any
+static void echo_queue_pop(struct echo_queue *queue)
+{
+    metrics_since(HIST_ECHO, queue->queued_ns[queue->head]);
+    echo_finish(&queue->current);
+    queue->head = (queue->head + 1) % ECHO_QUEUE_DEPTH;
+    if (--queue->count == 0)
+        return;
+    unsigned int head = queue->head;
+    if (queue->started > 0) {
+        // Already gathered from this start: bytes sent past the previous echo count from it
+        queue->started--;
+        echo_begin_at(&queue->current, &queue->starts[head], queue->start_pins[head], queue->ends[head],
+                      queue->count == 1);
+    } else {
+        echo_begin(&queue->current, queue->ends[head], queue->count == 1);
+    }
+}
+
+// Complete the echoes at the head that have nothing to send (empty log); @return true if any are left
+static bool echo_queue_skip_done(struct echo_queue *queue)
+{
+    while (queue->count > 0 && echo_done(&queue->current))
+        echo_queue_pop(queue);
+    return queue->count > 0;
+}
+
+int echo_queue_fill_iov(struct echo_queue *queue, struct iovec *iov, int max_iov)
+{
+    if (!echo_queue_skip_done(queue))
+        return 0;
+
+    // Gather the rest of the current echo and as many queued ones as fit
+    struct echo *current = &queue->current;
+    int iovcnt = datalog_fill_iov(&data_log, &current->cursor, current->end, iov, max_iov);
+    for (unsigned int i = 1; i < queue->count && iovcnt < max_iov; i++) {
+        unsigned int slot = (queue->head + i) % ECHO_QUEUE_DEPTH;
+        if (i > queue->started) {
+            queue->start_pins[slot] = datalog_pin(&data_log);
+            datalog_cursor_init(&data_log, &queue->starts[slot]);
+            queue->started = i;
+        }
+        iovcnt += datalog_fill_iov(&data_log, &queue->starts[slot], queue->ends[slot], iov + iovcnt,
+                                   max_iov - iovcnt);
+    }
+    return iovcnt;
+}
+
+void echo_queue_advance(struct echo_queue *queue, size_t sent)
+{
+    struct echo *current = &queue->current;
+
+    metrics_count(COUNTER_BYTES_ECHOED, sent);
+    while (sent > 0) {
+        size_t left = current->end - current->cursor.offset;
+        if (sent < left) {
+            datalog_cursor_advance(&data_log, &current->cursor, sent, current->end);
+            break;
+        }
+        sent -= left;
+        echo_queue_pop(queue);
+    }
+}
+
+ssize_t echo_queue_send(struct echo_queue *queue, int sockfd, int flags)
+{
+    if (!echo_queue_skip_done(queue))
+        return 0;
+
+    struct echo *current = &queue->current;
+    if (current->zero_copy) {
+        ssize_t sent = echo_send(current, sockfd, flags);
+        if (sent > 0 && echo_done(current))
+            echo_queue_pop(queue);
+        return sent;
+    }
+
+    struct iovec iov[ECHO_QUEUE_IOV];
+    int iovcnt = echo_queue_fill_iov(queue, iov, ECHO_QUEUE_IOV);
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    ssize_t sent = sendmsg(sockfd, &msg, flags);
+    if (sent > 0)
+        echo_queue_advance(queue, sent);
+    return sent;
+}
@@ -0,0 +1,101 @@
+#ifndef ECHO_H
+#define ECHO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "datalog.h"
+
+/**
+ * Progress of sending the data log history back to one client.
+ * The zero-copy path sends straight from the data file with sendfile(); if the kernel
+ * refuses it the echo continues from the in-memory log at the same offset.  A log kept in
+ * segment files has no single data file and is always sent from its mapped segments.
+ * The echo pins the log (datalog_pin()) from echo_start() to echo_finish().
+ */
+struct echo {
+    struct datalog_cursor cursor;
+    size_t end;       // Log length snapshot to send up to
+    bool zero_copy;   // Still sending with sendfile()
+    bool pinned;
+    unsigned int pin;
+};
+
+// Prepare @param echo to send log bytes [0, @param end), or from the oldest retained byte
+void echo_start(struct echo *echo, size_t end);
+
+// Release @param echo, sent or not
+void echo_finish(struct echo *echo);
+
+static inline bool echo_done(const struct echo *echo)
+{
+    return echo->cursor.offset >= echo->end;
+}
+
+/**
+ * Acknowledgements owed to a pipelining client, in packet order.  Each entry is the log
+ * length committed right after that client's packet was appended, and is answered with
+ * the history up to that length.  A lone echo may use sendfile(); a backlog of echoes is
+ * gathered into one sendmsg()/writev-style iovec.
+ */
+#define ECHO_QUEUE_DEPTH 64
+
+struct echo_queue {
+    size_t ends[ECHO_QUEUE_DEPTH];
+    uint64_t queued_ns[ECHO_QUEUE_DEPTH]; // metrics_now() when each echo was queued
+    unsigned int head;
+    unsigned int count;
+    struct echo current; // Progress of ends[head]
+    // Where the echoes after the head begin, once gathered: the first `started` of them,
+    // each pinned, so they keep the start they were (partly) sent from when they become current
+    struct datalog_cursor starts[ECHO_QUEUE_DEPTH];
+    unsigned int start_pins[ECHO_QUEUE_DEPTH];
+    unsigned int started;
+};
+
+void echo_queue_init(struct echo_queue *queue);
+
+// Drop the echoes still queued, when the connection is closed
+void echo_queue_release(struct echo_queue *queue);
+
+static inline bool echo_queue_empty(const struct echo_queue *queue)
+{
+    return queue->count == 0;
+}
+
+static inline bool echo_queue_full(const struct echo_queue *queue)
+{
+    return queue->count == ECHO_QUEUE_DEPTH;
+}
+
+// Queue an echo of log bytes [0, @param end); the queue must not be full
+void echo_queue_push(struct echo_queue *queue, size_t end);
+
+/**
+ * Describe the unsent rest of the queued echoes, in order, in up to @param max_iov entries
+ * of @param iov, completing echoes with nothing left to send first.  For senders that issue
+ * the send themselves (io_uring); the copy path only, so config.zero_copy must be off.
+ * @return the number of entries filled, 0 if the queue is empty.
+ */
+int echo_queue_fill_iov(struct echo_queue *queue, struct iovec *iov, int max_iov);
+
+// Account @param sent bytes of what echo_queue_fill_iov() described as sent
+void echo_queue_advance(struct echo_queue *queue, size_t sent);
+
+/**
+ * Send as much of the queued echoes as one call allows, completing them in order.
+ * @return bytes sent (0 if the queue is empty), or -1 with errno set.
+ */
+ssize_t echo_queue_send(struct echo_queue *queue, int sockfd, int flags);
+
+/**
+ * Send the next part of the echo on @param sockfd.  @param flags are only used by the
+ * copy path; non-blocking behaviour on the zero-copy path comes from the socket itself.
+ * @return bytes sent, or -1 with errno set (EAGAIN when a non-blocking socket is full).
+ */
+ssize_t echo_send(struct echo *echo, int sockfd, int flags);
+
+#endif /* ECHO_H */
@@ -0,0 +1,184 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "frame.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAME_X86 1
+#endif
+
+/**
+ * Scalar scan of @param data[@param from, @param len), appending to the @param found offsets
+ * already stored.  Also finishes the tail the vector loops leave behind.
+ */
+static size_t frame_scan_from(const char *data, size_t from, size_t len, size_t *offsets,
+                              size_t found, size_t max)
+{
+    const char *p = data + from, *end = data + len;
+
+    while (found < max && p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (!newline)
+            break;
+        offsets[found++] = newline - data;
+        p = newline + 1;
+    }
+    return found;
+}
+
+static size_t frame_scan_scalar(const char *data, size_t len, size_t *offsets, size_t max)
+{
+    return frame_scan_from(data, 0, len, offsets, 0, max);
+}
+
+#ifdef FRAME_X86
+
+// Append the offsets flagged in @param mask, where bit i stands for data[base + i]
+static inline size_t frame_emit(uint64_t mask, size_t base, size_t *offsets, size_t found,
+                                size_t max)
+{
+    while (mask && found < max) {
+        offsets[found++] = base + __builtin_ctzll(mask);
+        mask &= mask - 1;
+    }
+    return found;
+}
+
+/**
+ * Both loops test 64 bytes per iteration and build a bit mask of the newlines in the block,
+ * which is where dense input (many short packets per chunk) gains over a memchr() call per
+ * packet.  A second block in a row without a newline hands the search to memchr(), whose
+ * wider unrolled loop is faster over long runs, and resumes at the block holding the
+ * newline it finds.
+ */
+static inline size_t frame_skip(const char *data, size_t i, size_t len)
+{
+    const char *newline = memchr(data + i, '\n', len - i);
+    return newline ? (size_t)(newline - data) & ~(size_t)63 : len;
+}
+
+__attribute__((target("sse2")))
+static size_t frame_scan_sse2(const char *data, size_t len, size_t *offsets, size_t max)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t found = 0, i = 0;
+    int idle = 0; // Blocks in a row without a newline
+
+    while (i + 64 <= len && found < max) {
+        const __m128i *p = (const __m128i *)(data + i);
+        __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128(p), newline);
+        __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), newline);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), newline);
+        __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), newline);
+        __m128i any = _mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3));
+        if (!_mm_movemask_epi8(any)) {
+            i = idle++ ? frame_skip(data, i + 64, len) : i + 64;
+            continue;
+        }
+        idle = 0;
+        uint64_t mask = (uint64_t)(unsigned int)_mm_movemask_epi8(m0) |
+                        (uint64_t)(unsigned int)_mm_movemask_epi8(m1) << 16 |
+                        (uint64_t)(unsigned int)_mm_movemask_epi8(m2) << 32 |
+                        (uint64_t)(unsigned int)_mm_movemask_epi8(m3) << 48;
+        found = frame_emit(mask, i, offsets, found, max);
+        i += 64;
+    }
+    return frame_scan_from(data, i, len, offsets, found, max);
+}
+
+__attribute__((target("avx2")))
+static size_t frame_scan_avx2(const char *data, size_t len, size_t *offsets, size_t max)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t found = 0, i = 0;
+    int idle = 0; // Blocks in a row without a newline
+
+    while (i + 64 <= len && found < max) {
+        const __m256i *p = (const __m256i *)(data + i);
+        __m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(p), newline);
+        __m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), newline);
+        __m256i any = _mm256_or_si256(m0, m1);
+        if (_mm256_testz_si256(any, any)) {
+            i = idle++ ? frame_skip(data, i + 64, len) : i + 64;
+            continue;
+        }
+        idle = 0;
+        uint64_t mask = (uint64_t)(unsigned int)_mm256_movemask_epi8(m0) |
+                        (uint64_t)(unsigned int)_mm256_movemask_epi8(m1) << 32;
+        found = frame_emit(mask, i, offsets, found, max);
+        i += 64;
+    }
+    return frame_scan_from(data, i, len, offsets, found, max);
+}
+
+#endif /* FRAME_X86 */
+
+typedef size_t (*frame_scan_fn)(const char *data, size_t len, size_t *offsets, size_t max);
+
+static const struct {
+    const char *name;
+    frame_scan_fn scan;
+} frame_impls[FRAME_IMPL_COUNT] = {
+    [FRAME_SCALAR] = { "scalar", frame_scan_scalar },
+#ifdef FRAME_X86
+    [FRAME_SSE2] = { "sse2", frame_scan_sse2 },
+    [FRAME_AVX2] = { "avx2", frame_scan_avx2 },
+#else
+    [FRAME_SSE2] = { "sse2", NULL },
+    [FRAME_AVX2] = { "avx2", NULL },
+#endif
+};
+
+static enum frame_impl selected = FRAME_SCALAR;
+
+int frame_impl_supported(enum frame_impl impl)
+{
+    switch (impl) {
+    case FRAME_SCALAR:
+        return 1;
+#ifdef FRAME_X86
+    case FRAME_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case FRAME_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+// Pick the widest supported implementation before any thread can scan
+__attribute__((constructor))
+static void frame_select(void)
+{
+#ifdef FRAME_X86
+    __builtin_cpu_init();
+#endif
+    for (int impl = FRAME_IMPL_COUNT - 1; impl > FRAME_SCALAR; impl--) {
+        if (frame_impl_supported(impl)) {
+            selected = impl;
+            return;
+        }
+    }
+}
+
+size_t frame_scan(const char *data, size_t len, size_t *offsets, size_t max)
+{
+    return frame_impls[selected].scan(data, len, offsets, max);
+}
+
+size_t frame_scan_impl(enum frame_impl impl, const char *data, size_t len, size_t *offsets, size_t max)
+{
+    return frame_impls[impl].scan(data, len, offsets, max);
+}
+
+const char *frame_impl_name(enum frame_impl impl)
+{
+    return frame_impls[impl].name;
+}
+
+enum frame_impl frame_impl_selected(void)
+{
+    return selected;
+}
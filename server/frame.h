@@ -0,0 +1,38 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+
+/**
+ * Newline scanning for packet framing.  frame_scan() reports every '\n' in a chunk in one
+ * pass, so a recv() holding many packets is split without a memchr() call per packet.
+ * On x86 it compares 32 (AVX2) or 16 (SSE2) bytes at a time and walks the resulting bit
+ * mask; the implementation is picked once at startup from the CPU's features.
+ */
+enum frame_impl {
+    FRAME_SCALAR, // memchr() per newline, the portable fallback
+    FRAME_SSE2,
+    FRAME_AVX2,
+    FRAME_IMPL_COUNT,
+};
+
+/**
+ * Store the offsets of the first newlines in @param data[0, @param len) in @param offsets,
+ * at most @param max of them.  Embedded NUL bytes are ordinary bytes.
+ * @return the number of offsets stored; if it is less than @param max, data holds no other
+ * newline.
+ */
+size_t frame_scan(const char *data, size_t len, size_t *offsets, size_t max);
+
+// frame_scan() with a given implementation, which must be supported (for benchmarks)
+size_t frame_scan_impl(enum frame_impl impl, const char *data, size_t len, size_t *offsets, size_t max);
+
+// @return true if @param impl can run on this CPU
+int frame_impl_supported(enum frame_impl impl);
+
+const char *frame_impl_name(enum frame_impl impl);
+
+// @return the implementation frame_scan() dispatches to
+enum frame_impl frame_impl_selected(void);
+
+#endif /* FRAME_H */
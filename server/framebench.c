@@ -0,0 +1,199 @@
+/**
+ * Microbenchmark for packet framing.
+ *
+ * Splits a buffer of random newline-terminated packets into recv()-sized chunks and times
+ * how fast each approach finds every packet boundary:
+ *   strchr  - the original handler: copy each chunk into a NUL-terminated buffer and call
+ *             strchr() once per packet (which also stops early at embedded NULs)
+ *   memchr  - one memchr() call per packet, as packet_collect() did before frame_scan()
+ *   scalar, sse2, avx2 - frame_scan_impl(), every newline of a chunk in one call
+ * Each approach must find the same number of packets; the result is reported per byte and
+ * per packet.  The Makefile builds without optimization, so for meaningful numbers build
+ * with e.g. "gcc -O2 -o framebench framebench.c frame.c".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+#define SCAN_BATCH 64 // Offsets per frame_scan() call, as in packet_collect()
+
+struct bench_config {
+    size_t total;       // Bytes of packets to generate
+    size_t packet_size; // Mean packet size, including the newline
+    size_t chunk;       // Bytes per simulated recv()
+    int rounds;         // Passes over the buffer per approach
+};
+
+static struct bench_config config = {
+    .total = 64 << 20,
+    .packet_size = 64,
+    .chunk = 4080, // SLAB_DATA_SIZE on 64-bit
+    .rounds = 5,
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Packets of 1 to 2 * packet_size - 1 bytes of printable text, each ending in '\n'
+static size_t fill_packets(char *buf, size_t len, size_t packet_size)
+{
+    size_t packets = 0, next = 0;
+    unsigned int seed = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (i == next) {
+            next = i + 1 + rand_r(&seed) % (2 * packet_size - 1);
+            if (i > 0) {
+                buf[i - 1] = '\n';
+                packets++;
+            }
+        }
+        buf[i] = 'a' + i % 26;
+    }
+    buf[len - 1] = '\n';
+    return packets + 1;
+}
+
+static size_t count_strchr(const char *buf, size_t len, char *copy)
+{
+    size_t packets = 0;
+
+    for (size_t off = 0; off < len; off += config.chunk) {
+        size_t n = len - off < config.chunk ? len - off : config.chunk;
+        memcpy(copy, buf + off, n);
+        copy[n] = '\0';
+        for (char *p = copy; (p = strchr(p, '\n')) != NULL; p++)
+            packets++;
+    }
+    return packets;
+}
+
+static size_t count_memchr(const char *buf, size_t len)
+{
+    size_t packets = 0;
+
+    for (size_t off = 0; off < len; off += config.chunk) {
+        size_t n = len - off < config.chunk ? len - off : config.chunk;
+        const char *p = buf + off, *end = p + n;
+        while ((p = memchr(p, '\n', end - p)) != NULL) {
+            packets++;
+            p++;
+        }
+    }
+    return packets;
+}
+
+static size_t count_frame(enum frame_impl impl, const char *buf, size_t len)
+{
+    size_t offsets[SCAN_BATCH];
+    size_t packets = 0;
+
+    for (size_t off = 0; off < len; off += config.chunk) {
+        size_t n = len - off < config.chunk ? len - off : config.chunk;
+        size_t from = 0, found;
+        do {
+            found = frame_scan_impl(impl, buf + off + from, n - from, offsets, SCAN_BATCH);
+            packets += found;
+            if (found)
+                from += offsets[found - 1] + 1;
+        } while (found == SCAN_BATCH);
+    }
+    return packets;
+}
+
+static void report(const char *name, uint64_t best_ns, size_t packets, size_t expected)
+{
+    printf("%-8s %8.2f GB/s %8.2f ns/packet%s\n", name, (double)config.total / best_ns,
+           (double)best_ns / packets, packets == expected ? "" : "  WRONG PACKET COUNT");
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-m megabytes] [-s mean_packet_size] [-c chunk_size] [-r rounds]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "m:s:c:r:")) != -1) {
+        switch (c) {
+        case 'm':
+            config.total = strtoul(optarg, NULL, 10) << 20;
+            break;
+        case 's':
+            config.packet_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            config.chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            config.rounds = (int)strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (config.total == 0 || config.packet_size < 1 || config.chunk < 1 || config.rounds < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char *buf = malloc(config.total);
+    char *copy = malloc(config.chunk + 1);
+    if (!buf || !copy) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    size_t expected = fill_packets(buf, config.total, config.packet_size);
+    printf("%zu MiB, %zu packets (mean %zu bytes), %zu-byte chunks, frame_scan() uses %s\n",
+           config.total >> 20, expected, config.packet_size, config.chunk,
+           frame_impl_name(frame_impl_selected()));
+
+    // Best of several rounds; each approach also returns its packet count to be checked
+    uint64_t best = UINT64_MAX;
+    size_t packets = 0;
+    for (int r = 0; r < config.rounds; r++) {
+        uint64_t start = now_ns();
+        packets = count_strchr(buf, config.total, copy);
+        uint64_t elapsed = now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    report("strchr", best, packets, expected);
+
+    best = UINT64_MAX;
+    for (int r = 0; r < config.rounds; r++) {
+        uint64_t start = now_ns();
+        packets = count_memchr(buf, config.total);
+        uint64_t elapsed = now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    report("memchr", best, packets, expected);
+
+    for (int impl = 0; impl < FRAME_IMPL_COUNT; impl++) {
+        if (!frame_impl_supported(impl))
+            continue;
+        best = UINT64_MAX;
+        for (int r = 0; r < config.rounds; r++) {
+            uint64_t start = now_ns();
+            packets = count_frame(impl, buf, config.total);
+            uint64_t elapsed = now_ns() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        report(frame_impl_name(impl), best, packets, expected);
+    }
+
+    free(buf);
+    free(copy);
+    return 0;
+}
@@ -0,0 +1,312 @@
+#define _GNU_SOURCE // struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "aesdsocket.h"
+#include "datalog.h"
+#include "handoff.h"
+
+#define HANDOFF_MAGIC 0x61657364u // "aesd"
+#define HANDOFF_MAX_FDS 253       // SCM_MAX_FD
+#define HANDOFF_POLL_MS 1000      // Wake up at least once a second to check stop_flag
+
+// Sent with the listening sockets, then the data file if there is one, as SCM_RIGHTS
+struct handoff_message {
+    uint32_t magic;
+    uint32_t listeners;
+    uint32_t data_file; // 1 if the data file follows the listening sockets
+    uint32_t reserved;
+    uint64_t length;    // Committed length of the data log
+};
+
+static int listen_fd = -1;
+static int successor_fd = -1;
+static char *socket_path;
+static pthread_t handoff_tid;
+static bool started;
+static bool finished;
+static pthread_mutex_t finish_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finish_cond;
+
+static int handoff_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        syslog(LOG_ERR, "Handoff socket path too long: %s", path);
+        return -1;
+    }
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int handoff_receive(const char *path, int **fds, int *data_fd, size_t *length)
+{
+    struct sockaddr_un addr;
+    if (handoff_address(path, &addr) < 0)
+        return -1;
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        syslog(LOG_ERR, "Failed to create handoff socket: %s", strerror(errno));
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        int err = errno;
+        close(sock);
+        if (err == ENOENT || err == ECONNREFUSED)
+            return 0; // Nothing running, or a socket left behind by a crash
+        syslog(LOG_ERR, "Failed to connect to handoff socket %s: %s", path, strerror(err));
+        return -1;
+    }
+    syslog(LOG_INFO, "Taking over from the instance at %s", path);
+
+    // The predecessor only answers once its connections have drained
+    struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT_SECONDS };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct handoff_message msg;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t n;
+    while ((n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+        ;
+    int recv_errno = errno;
+    close(sock);
+    if (n == 0) {
+        // It exited without handing off, and took its listening sockets along
+        syslog(LOG_WARNING, "Instance at %s exited before handing off, starting afresh", path);
+        return 0;
+    }
+    if (n == -1) {
+        syslog(LOG_ERR, "Failed to receive handoff from %s: %s", path, strerror(recv_errno));
+        return -1;
+    }
+
+    int *received = NULL, count = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        received = (int *)CMSG_DATA(cmsg);
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    }
+    if (n != sizeof(msg) || msg.magic != HANDOFF_MAGIC || (mh.msg_flags & MSG_CTRUNC) || msg.listeners == 0 ||
+        msg.data_file > 1 || (uint32_t)count != msg.listeners + msg.data_file) {
+        syslog(LOG_ERR, "Malformed handoff from %s", path);
+        for (int i = 0; i < count; i++)
+            close(received[i]);
+        return -1;
+    }
+
+    *fds = malloc(msg.listeners * sizeof(**fds));
+    if (!*fds) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        for (int i = 0; i < count; i++)
+            close(received[i]);
+        return -1;
+    }
+    for (uint32_t i = 0; i < msg.listeners; i++) {
+        // The epoll reactors made them non-blocking; each mode sets what it needs
+        int flags = fcntl(received[i], F_GETFL, 0);
+        if (flags != -1)
+            fcntl(received[i], F_SETFL, flags & ~O_NONBLOCK);
+        (*fds)[i] = received[i];
+    }
+    *data_fd = msg.data_file ? received[msg.listeners] : -1;
+    *length = msg.length;
+    return (int)msg.listeners;
+}
+
+// Take the first successor that connects, then drain for at most HANDOFF_DRAIN_SECONDS
+static void *handoff_thread(void *arg)
+{
+    (void)arg;
+
+    while (!stop_flag && successor_fd == -1) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        int n = poll(&pfd, 1, HANDOFF_POLL_MS);
+        if (n <= 0)
+            continue; // Timeout or signal, check stop_flag
+
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                syslog(LOG_ERR, "Failed to accept handoff connection: %s", strerror(errno));
+            continue;
+        }
+        // Whoever takes over gets the listening sockets and the data, so only trust ourselves
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+            (cred.uid != geteuid() && cred.uid != 0)) {
+            syslog(LOG_WARNING, "Refused handoff to a process of another user");
+            close(fd);
+            continue;
+        }
+        successor_fd = fd;
+    }
+    if (successor_fd == -1)
+        return NULL;
+    // There is only one successor; it binds the path afresh once it has taken over
+    close(listen_fd);
+    listen_fd = -1;
+
+    syslog(LOG_INFO, "Successor connected, draining connections for hot restart");
+    printf("Successor connected, draining connections for hot restart\n");
+    drain_flag = 1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += HANDOFF_DRAIN_SECONDS;
+    pthread_mutex_lock(&finish_mutex);
+    while (!finished && pthread_cond_timedwait(&finish_cond, &finish_mutex, &deadline) != ETIMEDOUT)
+        ;
+    if (!finished && !stop_flag) {
+        syslog(LOG_WARNING, "Connections still open after %d s, closing them", HANDOFF_DRAIN_SECONDS);
+        stop_flag = 1;
+    }
+    pthread_mutex_unlock(&finish_mutex);
+    return NULL;
+}
+
+int handoff_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (handoff_address(path, &addr) < 0)
+        return -1;
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        syslog(LOG_ERR, "Failed to create handoff socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(path); // The socket of the instance taken over, or one left behind by a crash
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd, 1) == -1) {
+        syslog(LOG_ERR, "Failed to listen for a successor on %s: %s", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    socket_path = strdup(path);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&finish_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&handoff_tid, NULL, handoff_thread, NULL) != 0) {
+        syslog(LOG_ERR, "Failed to create handoff thread");
+        pthread_cond_destroy(&finish_cond);
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path);
+        free(socket_path);
+        socket_path = NULL;
+        return -1;
+    }
+    started = true;
+    syslog(LOG_INFO, "Listening for a successor on %s", path);
+    return 0;
+}
+
+static int handoff_send(int sock, const int *fds, int count, int data_fd, size_t length)
+{
+    int nfds = count + (data_fd != -1);
+    if (nfds > HANDOFF_MAX_FDS) {
+        syslog(LOG_ERR, "Too many listening sockets to hand off: %d", count);
+        return -1;
+    }
+
+    struct handoff_message msg = {
+        .magic = HANDOFF_MAGIC,
+        .listeners = count,
+        .data_file = data_fd != -1,
+        .length = length,
+    };
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    int *out = (int *)CMSG_DATA(cmsg);
+    memcpy(out, fds, sizeof(int) * count);
+    if (data_fd != -1)
+        out[count] = data_fd;
+
+    while (sendmsg(sock, &mh, MSG_NOSIGNAL) == -1) {
+        if (errno == EINTR)
+            continue;
+        syslog(LOG_ERR, "Failed to hand off to successor: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+bool handoff_finish(const int *fds, int count)
+{
+    if (!started)
+        return false;
+
+    pthread_mutex_lock(&finish_mutex);
+    finished = true;
+    pthread_cond_signal(&finish_cond);
+    pthread_mutex_unlock(&finish_mutex);
+    pthread_join(handoff_tid, NULL);
+    pthread_cond_destroy(&finish_cond);
+    started = false;
+
+    bool handed_off = false;
+    if (successor_fd == -1) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+    } else {
+        // Nothing may be appended once the length is taken (stragglers past the deadline)
+        pthread_mutex_lock(&file_mutex);
+        datalog_freeze(&data_log);
+        size_t length = datalog_length(&data_log);
+        pthread_mutex_unlock(&file_mutex);
+
+        handed_off = handoff_send(successor_fd, fds, count, data_log.fd, length) == 0;
+        close(successor_fd);
+        if (handed_off) {
+            syslog(LOG_INFO, "Handed %d listening sockets and %zu bytes of data to successor", count, length);
+            printf("Handed %d listening sockets and %zu bytes of data to successor\n", count, length);
+        }
+    }
+    successor_fd = -1;
+    free(socket_path);
+    socket_path = NULL;
+    return handed_off;
+}
@@ -0,0 +1,43 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Hot restart (-H path).  A running instance listens on a Unix socket at path for its
+ * successor.  When one connects, the running instance stops accepting (drain_flag) and lets
+ * the connections it holds finish, for at most HANDOFF_DRAIN_SECONDS.  It then freezes the
+ * data log and sends its listening sockets and data file over the socket (SCM_RIGHTS), and
+ * exits without removing the data.  The sockets stay open throughout, so connections that
+ * arrive meanwhile wait in their accept queue for the successor instead of being refused.
+ */
+#define HANDOFF_DRAIN_SECONDS 10   // Connections still open after this are closed
+#define HANDOFF_TIMEOUT_SECONDS 30 // How long a successor waits for the handoff
+
+/**
+ * Take over from the instance listening for a successor on @param path, if there is one.
+ * On success *@param fds is a malloc()ed array of its listening sockets, *@param data_fd
+ * its data file (-1 if it kept a segment directory) and *@param length the committed
+ * length of its data log.
+ * @return the number of listening sockets received, 0 if no instance handed off
+ *      (start afresh), or -1 on failure (logged).
+ */
+int handoff_receive(const char *path, int **fds, int *data_fd, size_t *length);
+
+/**
+ * Listen on @param path for a successor, replacing the socket of the instance taken over
+ * (or a stale one), and start the thread that waits for it.
+ * @return 0 on success, -1 on failure (logged).
+ */
+int handoff_listen(const char *path);
+
+/**
+ * Called once the event loops have returned.  If a successor is waiting, freeze data_log
+ * and send it the @param count listening sockets in @param fds and the data log.
+ * Otherwise stop listening and remove the socket.
+ * @return true if the successor now owns the sockets and the data.
+ */
+bool handoff_finish(const int *fds, int count);
+
+#endif /* HANDOFF_H */
@@ -0,0 +1,57 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * HDR-style log-linear histogram buckets: values below HIST_SUB get a bucket each, and
+ * every power of two above that is split into HIST_SUB equal buckets, so any 64-bit value
+ * is recorded with a relative error below 1/HIST_SUB (about 6%) in a fixed, small table.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+static inline unsigned int hist_bucket(uint64_t value)
+{
+    if (value < HIST_SUB)
+        return value;
+    unsigned int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (unsigned int)(value >> shift) - HIST_SUB;
+}
+
+// @return the largest value recorded in @param bucket
+static inline uint64_t hist_bucket_max(unsigned int bucket)
+{
+    if (bucket < HIST_SUB)
+        return bucket;
+    unsigned int shift = bucket / HIST_SUB - 1;
+    uint64_t mantissa = bucket % HIST_SUB + HIST_SUB;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * @return the value at @param quantile of the @param count samples in @param buckets,
+ * as the upper bound of its bucket clamped to the largest sample @param max.
+ */
+static inline uint64_t hist_quantile(const uint64_t *buckets, uint64_t count, uint64_t max,
+                                     double quantile)
+{
+    uint64_t rank = (uint64_t)(quantile * count + 0.5);
+    uint64_t seen = 0;
+
+    if (count == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint64_t value = hist_bucket_max(i);
+            return value < max ? value : max;
+        }
+    }
+    return max;
+}
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "history.h"
+#include "aesd-circular-buffer.h"
+
+#define HISTORY_GATHER_IOV 64 // Entries gathered per aesd_circular_buffer_fill_iovec() call
+
+static struct aesd_circular_buffer ring;
+static struct aesd_buffer_entry *evicted; // Room for every entry one add can evict
+
+int history_init(unsigned int writes)
+{
+    if (aesd_circular_buffer_init_capacity(&ring, writes) < 0) {
+        syslog(LOG_ERR, "Failed to allocate history of %u writes", writes);
+        return -1;
+    }
+    evicted = calloc(writes, sizeof(*evicted));
+    if (!evicted) {
+        syslog(LOG_ERR, "Memory allocation failed");
+        aesd_circular_buffer_free(&ring);
+        return -1;
+    }
+    return 0;
+}
+
+void history_free(void)
+{
+    struct aesd_buffer_entry *entry;
+    unsigned int index;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &ring, index) {
+        free((char *)entry->buffptr);
+    }
+    aesd_circular_buffer_free(&ring);
+    free(evicted);
+    evicted = NULL;
+}
+
+int history_add(const struct datalog_record *records, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        size_t len = 0;
+        for (unsigned int b = 0; b < records[i].iovcnt; b++)
+            len += records[i].iov[b].iov_len;
+        if (len == 0)
+            continue;
+
+        char *copy = malloc(len);
+        if (!copy) {
+            syslog(LOG_ERR, "Memory allocation failed");
+            return -1;
+        }
+        struct aesd_buffer_entry entry = { .buffptr = copy, .size = len };
+        for (unsigned int b = 0; b < records[i].iovcnt; b++) {
+            memcpy(copy, records[i].iov[b].iov_base, records[i].iov[b].iov_len);
+            copy += records[i].iov[b].iov_len;
+        }
+
+        int n = aesd_circular_buffer_add_entry_evict(&ring, &entry, evicted, ring.capacity);
+        for (int e = 0; e < n; e++)
+            free((char *)evicted[e].buffptr);
+    }
+    return 0;
+}
+
+ssize_t history_snapshot(char **data)
+{
+    struct iovec iov[HISTORY_GATHER_IOV];
+
+    pthread_mutex_lock(&file_mutex);
+    size_t total = aesd_circular_buffer_total_size(&ring);
+    char *copy = malloc(total ? total : 1);
+    if (!copy) {
+        pthread_mutex_unlock(&file_mutex);
+        syslog(LOG_ERR, "Memory allocation failed");
+        return -1;
+    }
+
+    size_t offset = 0;
+    while (offset < total) {
+        unsigned int iovcnt = aesd_circular_buffer_fill_iovec(&ring, offset, total - offset, iov,
+                                                              HISTORY_GATHER_IOV, NULL);
+        for (unsigned int i = 0; i < iovcnt; i++) {
+            memcpy(copy + offset, iov[i].iov_base, iov[i].iov_len);
+            offset += iov[i].iov_len;
+        }
+    }
+    pthread_mutex_unlock(&file_mutex);
+
+    *data = copy;
+    return total;
+}
@@ -0,0 +1,35 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "datalog.h"
+
+/**
+ * The newest config.history_writes records, kept in an aesd_circular_buffer for -w: each
+ * record is copied into its own buffer, as /dev/aesdchar does for writes, and freed when
+ * it is evicted.  The data log still holds everything; only the echo is limited.
+ * Guarded by file_mutex, like the data log appends that feed it.
+ */
+
+// Set up an empty history of @param writes records; @return 0 on success, -1 on failure
+int history_init(unsigned int writes);
+
+// Free every record still held
+void history_free(void);
+
+/**
+ * Add @param count records just appended to the data log, evicting the oldest ones.
+ * Caller must hold file_mutex.  @return 0 on success, -1 if memory ran out.
+ */
+int history_add(const struct datalog_record *records, unsigned int count);
+
+/**
+ * Copy the current history into a new buffer, gathered from the ring in one pass under
+ * file_mutex, so that it can be sent without holding the lock.
+ * @return its length, with *@param data set to the buffer (to free()), or -1 on failure.
+ */
+ssize_t history_snapshot(char **data);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "aesdsocket.h"
+#include "histogram.h"
+#include "metrics.h"
+
+#define METRICS_BACKLOG 16
+#define METRICS_POLL_MS 1000     // Wake up at least once a second to check stop_flag
+#define METRICS_REQUEST_MS 100   // How long to wait for an optional HTTP request line
+
+struct metrics_hist {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[HIST_BUCKETS];
+};
+
+/**
+ * Counters and histograms written by one thread at a time.  The owner updates them with
+ * plain relaxed loads and stores (no locked instructions); the scraper only reads.
+ * When a thread exits its shard is parked on a free list and adopted, totals intact, by
+ * the next thread that needs one, so per-connection threads do not grow the registry.
+ */
+struct metrics_shard {
+    struct metrics_shard *next;      // Every shard ever created, for snapshots
+    struct metrics_shard *next_free;
+    _Atomic uint64_t counters[COUNTER_COUNT];
+    struct metrics_hist hist[HIST_COUNT];
+};
+
+bool metrics_enabled;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics_shard *shards;
+static struct metrics_shard *free_shards;
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread struct metrics_shard *shard;
+
+static int listen_fd = -1;
+static char *unix_path;
+static pthread_t metrics_tid;
+
+static const char *const counter_names[COUNTER_COUNT] = {
+    [COUNTER_ACCEPTED] = "connections_accepted",
+    [COUNTER_CLOSED] = "connections_closed",
+    [COUNTER_RECORDS] = "records_appended",
+    [COUNTER_BYTES_RECEIVED] = "bytes_received",
+    [COUNTER_BYTES_ECHOED] = "bytes_echoed",
+};
+
+static const char *const hist_names[HIST_COUNT] = {
+    [HIST_FIRST_BYTE] = "first_byte",
+    [HIST_ASSEMBLY] = "packet_assembly",
+    [HIST_LOCK_WAIT] = "lock_wait",
+    [HIST_APPEND] = "append",
+    [HIST_ECHO] = "echo",
+};
+
+static void shard_release(void *arg)
+{
+    struct metrics_shard *s = arg;
+
+    pthread_mutex_lock(&registry_mutex);
+    s->next_free = free_shards;
+    free_shards = s;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void shard_key_create(void)
+{
+    pthread_key_create(&shard_key, shard_release);
+}
+
+static struct metrics_shard *shard_get(void)
+{
+    if (shard)
+        return shard;
+
+    pthread_once(&shard_key_once, shard_key_create);
+    pthread_mutex_lock(&registry_mutex);
+    struct metrics_shard *s = free_shards;
+    if (s) {
+        free_shards = s->next_free;
+    } else {
+        s = calloc(1, sizeof(*s));
+        if (s) {
+            s->next = shards;
+            shards = s;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (!s)
+        return NULL; // Out of memory: drop the sample rather than fail the caller
+    pthread_setspecific(shard_key, s);
+    shard = s;
+    return s;
+}
+
+// Single-writer increment: the owning thread is the only one storing to @param v
+static inline void shard_add(_Atomic uint64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+void metrics_count(enum metrics_counter counter, uint64_t n)
+{
+    struct metrics_shard *s;
+
+    if (!metrics_enabled || !(s = shard_get()))
+        return;
+    shard_add(&s->counters[counter], n);
+}
+
+void metrics_since(enum metrics_histogram hist, uint64_t start)
+{
+    struct metrics_shard *s;
+
+    if (start == 0 || !(s = shard_get()))
+        return;
+
+    uint64_t value = metrics_now() - start;
+    struct metrics_hist *h = &s->hist[hist];
+    shard_add(&h->buckets[hist_bucket(value)], 1);
+    shard_add(&h->count, 1);
+    shard_add(&h->sum, value);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+// Totals of one histogram across all shards
+struct hist_snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static void metrics_print_stat(FILE *out, const char *name, atomic_ulong *value)
+{
+    fprintf(out, "aesdsocket_%s_total %lu\n", name, atomic_load_explicit(value, memory_order_relaxed));
+}
+
+// Write a snapshot of every metric to @param out in the Prometheus text format
+static void metrics_print(FILE *out, struct hist_snapshot *snapshot)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t counters[COUNTER_COUNT] = { 0 };
+
+    memset(snapshot, 0, HIST_COUNT * sizeof(*snapshot));
+    pthread_mutex_lock(&registry_mutex);
+    for (struct metrics_shard *s = shards; s; s = s->next) {
+        for (int c = 0; c < COUNTER_COUNT; c++)
+            counters[c] += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+        for (int h = 0; h < HIST_COUNT; h++) {
+            struct metrics_hist *src = &s->hist[h];
+            struct hist_snapshot *dst = &snapshot[h];
+            uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+            dst->count += atomic_load_explicit(&src->count, memory_order_relaxed);
+            dst->sum += atomic_load_explicit(&src->sum, memory_order_relaxed);
+            if (max > dst->max)
+                dst->max = max;
+            for (unsigned int i = 0; i < HIST_BUCKETS; i++)
+                dst->buckets[i] += atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    for (int c = 0; c < COUNTER_COUNT; c++)
+        fprintf(out, "aesdsocket_%s_total %llu\n", counter_names[c], (unsigned long long)counters[c]);
+    metrics_print_stat(out, "echo_sendfile", &stats.echo_sendfile);
+    metrics_print_stat(out, "echo_copy", &stats.echo_copy);
+    metrics_print_stat(out, "sendfile_fallback", &stats.sendfile_fallback);
+    metrics_print_stat(out, "pool_rejected", &stats.pool_rejected);
+    metrics_print_stat(out, "commit_batches", &stats.commit_batches);
+    metrics_print_stat(out, "commit_records", &stats.commit_records);
+    metrics_print_stat(out, "slab_allocated", &stats.slab_allocated);
+    metrics_print_stat(out, "slab_reused", &stats.slab_reused);
+    fprintf(out, "aesdsocket_pool_queue_depth %lu\n", atomic_load(&stats.pool_queue_depth));
+    fprintf(out, "aesdsocket_log_length_bytes %zu\n", datalog_length(&data_log));
+
+    for (int h = 0; h < HIST_COUNT; h++) {
+        const struct hist_snapshot *hs = &snapshot[h];
+        fprintf(out, "# TYPE aesdsocket_%s_ns summary\n", hist_names[h]);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            fprintf(out, "aesdsocket_%s_ns{quantile=\"%g\"} %llu\n", hist_names[h], quantiles[q],
+                    (unsigned long long)hist_quantile(hs->buckets, hs->count, hs->max, quantiles[q]));
+        fprintf(out, "aesdsocket_%s_ns_max %llu\n", hist_names[h], (unsigned long long)hs->max);
+        fprintf(out, "aesdsocket_%s_ns_sum %llu\n", hist_names[h], (unsigned long long)hs->sum);
+        fprintf(out, "aesdsocket_%s_ns_count %llu\n", hist_names[h], (unsigned long long)hs->count);
+    }
+}
+
+static void metrics_serve(int client_fd, struct hist_snapshot *snapshot)
+{
+    struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+    struct timeval timeout = { .tv_sec = 1 };
+    char request[1024];
+    char *text = NULL;
+    size_t len = 0;
+    bool http = false;
+
+    // A slow scraper must not hold up the metrics thread for long
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    // Read (and so consume) the request, if any, so closing does not reset the connection
+    if (poll(&pfd, 1, METRICS_REQUEST_MS) > 0) {
+        ssize_t n = recv(client_fd, request, sizeof(request), MSG_DONTWAIT);
+        http = n >= 4 && memcmp(request, "GET ", 4) == 0;
+    }
+
+    FILE *out = open_memstream(&text, &len);
+    if (!out) {
+        syslog(LOG_ERR, "Memory allocation failed");
+        return;
+    }
+    if (http)
+        fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+    metrics_print(out, snapshot);
+    fclose(out);
+
+    for (size_t sent = 0; sent < len; ) {
+        ssize_t n = send(client_fd, text + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        sent += n;
+    }
+    free(text);
+}
+
+static void *metrics_thread(void *arg)
+{
+    (void)arg;
+    struct hist_snapshot *snapshot = malloc(HIST_COUNT * sizeof(*snapshot));
+
+    if (!snapshot) {
+        syslog(LOG_ERR, "Memory allocation failed");
+        return NULL;
+    }
+
+    while (!stop_flag) {
+        struct pollfd pfd = { .fd = listen_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, METRICS_POLL_MS);
+        if (ready <= 0)
+            continue; // Timeout or signal, check stop_flag
+
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd == -1) {
+            if (errno != EINTR && errno != EAGAIN)
+                syslog(LOG_ERR, "Failed to accept metrics connection: %s", strerror(errno));
+            continue;
+        }
+        metrics_serve(client_fd, snapshot);
+        close(client_fd);
+    }
+    free(snapshot);
+    return NULL;
+}
+
+// Bind the metrics listener to @param addr, see metrics_start()
+static int metrics_listen(const char *addr)
+{
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int fd;
+
+    memset(&ss, 0, sizeof(ss));
+    if (strchr(addr, '/')) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&ss;
+        if (strlen(addr) >= sizeof(sun->sun_path)) {
+            syslog(LOG_ERR, "Metrics socket path too long: %s", addr);
+            return -1;
+        }
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, addr);
+        len = sizeof(*sun);
+        unlink(addr); // Left behind by a previous run
+        unix_path = strdup(addr);
+    } else {
+        char *end;
+        long port = strtol(addr, &end, 10);
+        if (*addr == '\0' || *end != '\0' || port <= 0 || port > 65535) {
+            syslog(LOG_ERR, "Invalid metrics port: %s", addr);
+            return -1;
+        }
+        struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local scrapers only
+        len = sizeof(*sin);
+    }
+
+    fd = socket(ss.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        syslog(LOG_ERR, "Failed to create metrics socket: %s", strerror(errno));
+        return -1;
+    }
+    int opt = 1;
+    if (ss.ss_family == AF_INET)
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(fd, (struct sockaddr *)&ss, len) == -1 || listen(fd, METRICS_BACKLOG) == -1) {
+        syslog(LOG_ERR, "Failed to listen for metrics on %s: %s", addr, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int metrics_start(const char *addr)
+{
+    listen_fd = metrics_listen(addr);
+    if (listen_fd == -1) {
+        free(unix_path);
+        unix_path = NULL;
+        return -1;
+    }
+
+    metrics_enabled = true;
+    if (pthread_create(&metrics_tid, NULL, metrics_thread, NULL) != 0) {
+        syslog(LOG_ERR, "Failed to create metrics thread");
+        metrics_enabled = false;
+        metrics_stop();
+        return -1;
+    }
+    syslog(LOG_INFO, "Serving metrics on %s", addr);
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    if (listen_fd == -1)
+        return;
+    if (metrics_enabled)
+        pthread_join(metrics_tid, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+    if (unix_path) {
+        unlink(unix_path);
+        free(unix_path);
+        unix_path = NULL;
+    }
+}
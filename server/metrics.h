@@ -0,0 +1,62 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Event counters
+enum metrics_counter {
+    COUNTER_ACCEPTED,       // Connections accepted
+    COUNTER_CLOSED,         // Connections closed after being served
+    COUNTER_RECORDS,        // Records appended to the data log
+    COUNTER_BYTES_RECEIVED, // Bytes received from clients
+    COUNTER_BYTES_ECHOED,   // Bytes of history sent back to clients
+    COUNTER_COUNT,
+};
+
+// Latency histograms, all in nanoseconds
+enum metrics_histogram {
+    HIST_FIRST_BYTE, // accept() to the first byte received
+    HIST_ASSEMBLY,   // First buffered byte of a packet to its newline being found
+    HIST_LOCK_WAIT,  // Waiting to acquire file_mutex
+    HIST_APPEND,     // Appending under file_mutex
+    HIST_ECHO,       // An echo becoming ready to send to its last byte being sent
+    HIST_COUNT,
+};
+
+extern bool metrics_enabled;
+
+/**
+ * @return the current CLOCK_MONOTONIC time in nanoseconds, or 0 when metrics are disabled
+ * so that the matching metrics_since() is skipped as well.
+ */
+static inline uint64_t metrics_now(void)
+{
+    struct timespec ts;
+
+    if (!metrics_enabled)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Add @param n to a counter of the calling thread's shard
+void metrics_count(enum metrics_counter counter, uint64_t n);
+
+// Record the time elapsed since @param start (from metrics_now()); does nothing if start is 0
+void metrics_since(enum metrics_histogram hist, uint64_t start);
+
+/**
+ * Enable metrics and serve them as text on @param addr: a TCP port on 127.0.0.1, or a
+ * Unix socket path if it contains a '/'.  Every connection gets one snapshot and is closed;
+ * a request starting with "GET " is answered with an HTTP/1.0 header first.
+ * @return 0 on success, -1 if the endpoint could not be set up.
+ */
+int metrics_start(const char *addr);
+
+// Stop serving metrics and remove the Unix socket, if any
+void metrics_stop(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,67 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * Intrusive lock-free multi-producer/single-consumer queue (Vyukov).
+ * Producers never block or retry: a push is one atomic exchange plus one store.
+ * mpsc_pop() may return NULL while a producer is between those two steps; such a
+ * producer always finishes its push, so consumers that sleep must be woken by the
+ * producer after the push (see the doorbells in commit.c and reactor.c).
+ */
+struct mpsc_node {
+    _Atomic(struct mpsc_node *) next;
+};
+
+struct mpsc_queue {
+    _Atomic(struct mpsc_node *) head; // Most recently pushed node, producers swap here
+    struct mpsc_node *tail;           // Next node to pop, consumer only
+    struct mpsc_node stub;
+};
+
+static inline void mpsc_init(struct mpsc_queue *q)
+{
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+static inline void mpsc_push(struct mpsc_queue *q, struct mpsc_node *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    struct mpsc_node *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+static inline struct mpsc_node *mpsc_pop(struct mpsc_queue *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL; // A producer is mid-push
+
+    // tail is the last node: put the stub behind it so tail can be handed out
+    mpsc_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+#endif /* MPSC_H */
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE // memrchr
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "frame.h"
+#include "metrics.h"
+#include "packet.h"
+
+#define PACKET_SCAN_BATCH 64 // Newlines found per frame_scan() call
+
+void packet_buffer_init(struct packet_buffer *pb)
+{
+    memset(pb, 0, sizeof(*pb));
+}
+
+void packet_buffer_free(struct packet_buffer *pb)
+{
+    struct slab *slab = pb->head;
+    while (slab) {
+        struct slab *next = slab->next;
+        slab_free(slab);
+        slab = next;
+    }
+    free(pb->iov);
+    packet_buffer_init(pb);
+}
+
+char *packet_buffer_reserve(struct packet_buffer *pb, size_t *avail)
+{
+    if (!pb->tail || pb->tail->len == SLAB_DATA_SIZE) {
+        struct slab *slab = slab_alloc();
+        if (!slab)
+            return NULL;
+        if (pb->tail) {
+            pb->tail->next = slab;
+        } else {
+            pb->head = slab;
+            pb->start = 0;
+        }
+        pb->tail = slab;
+    }
+    *avail = SLAB_DATA_SIZE - pb->tail->len;
+    return pb->tail->data + pb->tail->len;
+}
+
+void packet_buffer_commit(struct packet_buffer *pb, size_t size)
+{
+    if (size > 0 && pb->received == pb->consumed)
+        pb->first_ns = metrics_now();
+    pb->tail->len += size;
+    pb->received += size;
+    metrics_count(COUNTER_BYTES_RECEIVED, size);
+}
+
+// Store a slab piece at pb->iov[@param index], growing the array as needed
+static int packet_iov_set(struct packet_buffer *pb, unsigned int index, char *base, size_t len)
+{
+    if (index == pb->iov_cap) {
+        unsigned int cap = pb->iov_cap ? pb->iov_cap * 2 : ECHO_QUEUE_DEPTH;
+        struct iovec *iov = realloc(pb->iov, cap * sizeof(*iov));
+        if (!iov) {
+            syslog(LOG_ERR, "Memory allocation failed");
+            return -1;
+        }
+        pb->iov = iov;
+        pb->iov_cap = cap;
+    }
+    pb->iov[index].iov_base = base;
+    pb->iov[index].iov_len = len;
+    return 0;
+}
+
+int packet_collect(struct packet_buffer *pb, struct datalog_record *records, unsigned int max_packets,
+                   bool flush_partial)
+{
+    unsigned int count = 0;
+    unsigned int iovcnt = 0;
+    unsigned int first = 0;      // First piece of the packet being described
+    struct slab *slab = pb->head;
+    size_t offset = pb->start;
+    size_t pos = pb->consumed;   // Stream offset of slab->data + offset
+    size_t packet_pos = pos;     // Stream offset of the packet being described
+
+    while (slab && count < max_packets) {
+        if (offset == slab->len) {
+            slab = slab->next;
+            offset = 0;
+            continue;
+        }
+
+        size_t from = offset;
+        if (pos >= pb->scan_from && pos < pb->scan_to) {
+            size_t known = pb->scan_to - pos;
+            from += known < slab->len - offset ? known : slab->len - offset;
+        }
+
+        // Find the newlines of as many packets as are wanted in one pass over the slab
+        size_t newlines[PACKET_SCAN_BATCH];
+        size_t want = max_packets - count < PACKET_SCAN_BATCH ? max_packets - count : PACKET_SCAN_BATCH;
+        size_t found = frame_scan(slab->data + from, slab->len - from, newlines, want);
+
+        for (size_t i = 0; i < found; i++) {
+            size_t stop = from + newlines[i] + 1;
+            if (packet_iov_set(pb, iovcnt, slab->data + offset, stop - offset) < 0)
+                return -1;
+            iovcnt++;
+            pos += stop - offset;
+            offset = stop;
+            metrics_since(HIST_ASSEMBLY, pb->first_ns);
+            records[count++].iovcnt = iovcnt - first;
+            first = iovcnt;
+            packet_pos = pos;
+        }
+        if (found < want && offset < slab->len) {
+            // No newline in the rest of the slab: it all belongs to the packet being assembled
+            if (packet_iov_set(pb, iovcnt, slab->data + offset, slab->len - offset) < 0)
+                return -1;
+            iovcnt++;
+            pos += slab->len - offset;
+            offset = slab->len;
+        }
+    }
+
+    if (count < max_packets) {
+        // Ran out of bytes: the trailing partial packet holds no newline
+        pb->scan_from = packet_pos;
+        pb->scan_to = pos;
+        if (flush_partial && iovcnt > first) {
+            metrics_since(HIST_ASSEMBLY, pb->first_ns);
+            records[count++].iovcnt = iovcnt - first;
+        }
+    }
+
+    // pb->iov may have moved while growing, so point the records into it only now
+    struct iovec *iov = pb->iov;
+    for (unsigned int i = 0; i < count; i++) {
+        records[i].iov = iov;
+        iov += records[i].iovcnt;
+    }
+    return count;
+}
+
+int packet_collect_record(struct packet_buffer *pb, struct datalog_record *record, bool flush_partial)
+{
+    unsigned int iovcnt = 0;
+    unsigned int whole = 0;      // Pieces up to and including the last newline
+    size_t whole_len = 0;        // Length of the last of those pieces
+    size_t pos = pb->consumed;   // Stream offset of the piece being added
+    size_t packets_end = pos;    // Stream offset just past the last newline
+
+    for (struct slab *slab = pb->head; slab; slab = slab->next) {
+        size_t offset = slab == pb->head ? pb->start : 0;
+        if (offset == slab->len)
+            continue;
+
+        size_t from = offset;
+        if (pos >= pb->scan_from && pos < pb->scan_to) {
+            size_t known = pb->scan_to - pos;
+            from += known < slab->len - offset ? known : slab->len - offset;
+        }
+        if (packet_iov_set(pb, iovcnt++, slab->data + offset, slab->len - offset) < 0)
+            return -1;
+        const char *newline = memrchr(slab->data + from, '\n', slab->len - from);
+        if (newline) {
+            whole = iovcnt;
+            whole_len = newline + 1 - (slab->data + offset);
+            packets_end = pos + whole_len;
+        }
+        pos += slab->len - offset;
+    }
+
+    // Whatever follows the last newline holds none
+    pb->scan_from = packets_end;
+    pb->scan_to = pos;
+    if (whole) {
+        pb->iov[whole - 1].iov_len = whole_len;
+        iovcnt = whole;
+    } else if (!flush_partial || iovcnt == 0) {
+        return 0;
+    }
+    metrics_since(HIST_ASSEMBLY, pb->first_ns);
+    record->iov = pb->iov;
+    record->iovcnt = iovcnt;
+    return 1;
+}
+
+void packet_buffer_consume(struct packet_buffer *pb, size_t size)
+{
+    pb->consumed += size;
+    pb->start += size;
+    // Bytes of the next packet may already be here; time its assembly from now on
+    pb->first_ns = pb->consumed < pb->received ? metrics_now() : 0;
+    while (pb->head && pb->start >= pb->head->len) {
+        struct slab *next = pb->head->next;
+        pb->start -= pb->head->len;
+        slab_free(pb->head);
+        pb->head = next;
+    }
+    if (!pb->head) {
+        pb->tail = NULL;
+        pb->start = 0;
+    }
+}
+
+int packet_append_ready(struct packet_buffer *pb, struct echo_queue *acks, bool flush_partial,
+                        unsigned int max_packets)
+{
+    struct datalog_record records[ECHO_QUEUE_DEPTH];
+    size_t ends[ECHO_QUEUE_DEPTH];
+    unsigned int room = ECHO_QUEUE_DEPTH - acks->count;
+
+    if (max_packets > room)
+        max_packets = room;
+    int count = packet_collect(pb, records, max_packets, flush_partial);
+    if (count <= 0)
+        return count;
+
+    if (commit_append(records, count, ends) < 0)
+        return -1;
+    packet_accept(pb, acks, records, count, ends);
+    return count;
+}
+
+int packet_append_record(struct packet_buffer *pb, struct echo_queue *acks, bool flush_partial)
+{
+    struct datalog_record record;
+    size_t end;
+
+    int count = packet_collect_record(pb, &record, flush_partial);
+    if (count <= 0)
+        return count;
+
+    if (commit_append(&record, 1, &end) < 0)
+        return -1;
+    packet_accept(pb, acks, &record, 1, &end);
+    return 1;
+}
+
+void packet_accept(struct packet_buffer *pb, struct echo_queue *acks,
+                   const struct datalog_record *records, unsigned int count, const size_t *ends)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        size_t len = 0;
+        for (unsigned int b = 0; b < records[i].iovcnt; b++)
+            len += records[i].iov[b].iov_len;
+        // ends[i] is exactly the history up to and including this packet
+        echo_queue_push(acks, ends[i]);
+        packet_buffer_consume(pb, len);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "datalog.h"
+#include "echo.h"
+#include "slab.h"
+
+/**
+ * Receive buffer that splits a byte stream into newline-terminated packets.
+ * Bytes are received into a chain of slabs (see slab.h) and the chain only ever grows at
+ * the tail, so a packet may span several slabs and is described by one iovec per slab.
+ * Slabs are released as soon as every packet in them has been consumed.  Searching resumes
+ * where the previous search stopped, finds every newline in a slab in one frame_scan() pass,
+ * and treats embedded NUL bytes like any other byte.
+ */
+struct packet_buffer {
+    struct slab *head;     // Holds the first byte of the packet being assembled
+    struct slab *tail;     // Receives new bytes
+    size_t start;          // Offset of that first byte within head
+    size_t consumed;       // Stream offset of that first byte
+    size_t received;       // Stream offset just past the last received byte
+    size_t scan_from;      // Stream offsets [scan_from, scan_to) are known to hold no '\n'
+    size_t scan_to;
+    uint64_t first_ns;     // metrics_now() when the oldest pending byte was received
+    struct iovec *iov;     // Slab pieces of the packets described by packet_collect()
+    unsigned int iov_cap;
+};
+
+void packet_buffer_init(struct packet_buffer *pb);
+
+void packet_buffer_free(struct packet_buffer *pb);
+
+/**
+ * @return space for up to *@param avail more bytes at the end of the buffer, chaining a
+ * new slab when the tail is full, or NULL if memory could not be allocated.
+ */
+char *packet_buffer_reserve(struct packet_buffer *pb, size_t *avail);
+
+// Mark @param size bytes written into the space returned by packet_buffer_reserve() as received
+void packet_buffer_commit(struct packet_buffer *pb, size_t size);
+
+/**
+ * Describe up to @param max_packets complete packets (including their '\n') at the front
+ * of @param pb in @param records, without consuming them.  If @param flush_partial is set
+ * (the peer has closed its side) trailing bytes without a newline count as a final packet.
+ * The records point into the slabs and into pb->iov, so they stay valid until the packets
+ * are consumed or packet_collect() is called again; receiving more bytes does not move them.
+ * @return the number of records filled, or -1 if memory could not be allocated.
+ */
+int packet_collect(struct packet_buffer *pb, struct datalog_record *records, unsigned int max_packets,
+                   bool flush_partial);
+
+/**
+ * Like packet_collect(), for a connection that carries a single record: describe every
+ * complete packet at the front of @param pb, up to the last newline received, as one
+ * @param record.  With @param flush_partial all bytes received make up the record.
+ * @return 1 if the record was filled, 0 if it is not complete yet, or -1 if memory could
+ *      not be allocated.
+ */
+int packet_collect_record(struct packet_buffer *pb, struct datalog_record *record, bool flush_partial);
+
+// Drop @param size bytes from the front of the buffer, releasing slabs left empty
+void packet_buffer_consume(struct packet_buffer *pb, size_t size);
+
+static inline size_t packet_buffer_pending(const struct packet_buffer *pb)
+{
+    return pb->received - pb->consumed;
+}
+
+/**
+ * Append up to @param max_packets packets collected from @param pb (see packet_collect())
+ * to the data log, in order, for as long as @param acks has room, and queue an
+ * acknowledgement echo for each.  Blocks until the packets are committed.
+ * @return the number of packets appended, or -1 if an append failed.
+ */
+int packet_append_ready(struct packet_buffer *pb, struct echo_queue *acks, bool flush_partial,
+                        unsigned int max_packets);
+
+/**
+ * Append the single record collected from @param pb (see packet_collect_record()) to the
+ * data log and queue its acknowledgement echo on @param acks.  Blocks until it is committed.
+ * @return 1 if the record was appended, 0 if it is not complete yet, or -1 if the append failed.
+ */
+int packet_append_record(struct packet_buffer *pb, struct echo_queue *acks, bool flush_partial);
+
+/**
+ * Consume @param count committed packets described by @param records from the front of
+ * @param pb, queueing an echo up to ends[i] for each on @param acks.
+ */
+void packet_accept(struct packet_buffer *pb, struct echo_queue *acks,
+                   const struct datalog_record *records, unsigned int count, const size_t *ends);
+
+#endif /* PACKET_H */
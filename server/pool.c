@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "aesdsocket.h"
+#include "pool.h"
+
+static pthread_t *workers;
+static atomic_int *active_fds; // Socket each worker is serving, -1 when idle
+static int num_workers;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct client *queue; // Ring of accepted clients
+static unsigned int queue_head;
+static unsigned int queue_count;
+static bool stopping;
+
+static void *pool_worker(void *arg)
+{
+    atomic_int *active_fd = arg;
+
+    while (1) {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_count == 0 && !stopping)
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        if (stopping) {
+            pthread_mutex_unlock(&queue_mutex);
+            break;
+        }
+        struct client client = queue[queue_head];
+        queue_head = (queue_head + 1) % config.queue_depth;
+        queue_count--;
+        atomic_store_explicit(&stats.pool_queue_depth, queue_count, memory_order_relaxed);
+        atomic_store(active_fd, client.fd);
+        pthread_mutex_unlock(&queue_mutex);
+
+        serve_client(&client);
+        atomic_store(active_fd, -1);
+    }
+    return NULL;
+}
+
+int pool_start(void)
+{
+    queue = calloc(config.queue_depth, sizeof(*queue));
+    workers = calloc(config.num_threads, sizeof(*workers));
+    active_fds = calloc(config.num_threads, sizeof(*active_fds));
+    if (!queue || !workers || !active_fds) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        free(queue);
+        free(workers);
+        free(active_fds);
+        return -1;
+    }
+
+    for (num_workers = 0; num_workers < config.num_threads; num_workers++) {
+        atomic_init(&active_fds[num_workers], -1);
+        if (pthread_create(&workers[num_workers], NULL, pool_worker, &active_fds[num_workers]) != 0) {
+            syslog(LOG_ERR, "Failed to create worker thread");
+            pool_stop();
+            return -1;
+        }
+    }
+    syslog(LOG_INFO, "Serving with %d worker threads, queue depth %u",
+           config.num_threads, config.queue_depth);
+    return 0;
+}
+
+int pool_submit(const struct client *client)
+{
+    pthread_mutex_lock(&queue_mutex);
+    if (queue_count == config.queue_depth) {
+        pthread_mutex_unlock(&queue_mutex);
+
+        // Overloaded: tell the client now rather than letting it time out in the queue
+        atomic_fetch_add_explicit(&stats.pool_rejected, 1, memory_order_relaxed);
+        if (send(client->fd, POOL_BUSY_MESSAGE, strlen(POOL_BUSY_MESSAGE), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+            syslog(LOG_DEBUG, "Failed to send busy message: %s", strerror(errno));
+        close(client->fd);
+        return -1;
+    }
+
+    queue[(queue_head + queue_count) % config.queue_depth] = *client;
+    queue_count++;
+    atomic_store_explicit(&stats.pool_queue_depth, queue_count, memory_order_relaxed);
+    if (queue_count > atomic_load_explicit(&stats.pool_queue_peak, memory_order_relaxed))
+        atomic_store_explicit(&stats.pool_queue_peak, queue_count, memory_order_relaxed);
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
+
+bool pool_idle(void)
+{
+    pthread_mutex_lock(&queue_mutex);
+    bool idle = queue_count == 0;
+    for (int i = 0; i < num_workers && idle; i++)
+        idle = atomic_load(&active_fds[i]) == -1;
+    pthread_mutex_unlock(&queue_mutex);
+    return idle;
+}
+
+void pool_stop(void)
+{
+    pthread_mutex_lock(&queue_mutex);
+    stopping = true;
+    pthread_cond_broadcast(&queue_cond);
+    // Workers busy with a connection are woken out of recv()/send() by shutting it down.
+    // Holding queue_mutex keeps a worker from starting on a new socket meanwhile.
+    for (int i = 0; i < num_workers; i++) {
+        int fd = atomic_load(&active_fds[i]);
+        if (fd != -1)
+            shutdown(fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    for (int i = 0; i < num_workers; i++)
+        pthread_join(workers[i], NULL);
+
+    while (queue_count > 0) {
+        close(queue[queue_head].fd);
+        queue_head = (queue_head + 1) % config.queue_depth;
+        queue_count--;
+    }
+    free(workers);
+    free(active_fds);
+    free(queue);
+    workers = NULL;
+    active_fds = NULL;
+    queue = NULL;
+    num_workers = 0;
+}
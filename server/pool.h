@@ -0,0 +1,28 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "aesdsocket.h"
+
+/**
+ * Start config.num_threads worker threads serving connections from a bounded queue of
+ * config.queue_depth accepted sockets.
+ * @return 0 on success, -1 if the workers could not be started.
+ */
+int pool_start(void);
+
+/**
+ * Hand @param client to a worker.  When the queue is full the client is sent
+ * POOL_BUSY_MESSAGE and closed right away instead of waiting in the queue.
+ * @return 0 if the connection was queued, -1 if it was rejected.
+ */
+int pool_submit(const struct client *client);
+
+// @return true when no connection is queued or being served (hot restart drain)
+bool pool_idle(void);
+
+// Wake and join the workers; connections still queued are closed unserved
+void pool_stop(void);
+
+#define POOL_BUSY_MESSAGE "ERROR: server busy\n"
+
+#endif /* POOL_H */
@@ -0,0 +1,467 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "echo.h"
+#include "metrics.h"
+#include "packet.h"
+#include "reactor.h"
+#include "timestamp.h"
+
+#define MAX_EVENTS 64
+#define EPOLL_TIMEOUT_MS 1000 // Wake up at least once a second to check stop_flag
+
+// Per-connection state for the recv/append/echo cycle
+struct connection {
+    int fd;
+    bool eof;                // Peer closed its side
+    bool read_closed;        // Nothing more will be received from this connection
+    bool packet_taken;       // Without -k: its one record has been appended
+    bool committing;         // commit is queued on the group commit writer
+    uint32_t events;         // Interest currently registered with epoll
+    uint64_t accepted_ns;    // metrics_now() at accept(), cleared at the first byte
+    struct packet_buffer rx; // Bytes received but not yet appended
+    struct echo_queue acks;  // Echoes owed for appended packets, in order
+    struct reactor *reactor;
+    struct commit_request commit;
+    struct datalog_record records[ECHO_QUEUE_DEPTH]; // Packets in rx covered by commit
+    size_t ends[ECHO_QUEUE_DEPTH];
+    struct connection *prev;
+    struct connection *next;
+};
+
+struct reactor {
+    pthread_t tid;
+    int index;                      // Position among the reactors, for -C
+    int epoll_fd;
+    int server_fd;
+    int wake_fd;                    // eventfd rung by the group commit writer
+    int timer_fd;                   // Timestamp timer, -1 on all but the first reactor
+    struct mpsc_queue completions;  // Committed connections, pushed by the writer
+    unsigned int committing;        // Connections with a commit in flight
+    bool draining;                  // drain_flag seen, the listener is no longer watched
+    struct connection *connections; // Open connections owned by this reactor
+};
+
+static void conn_close(struct reactor *r, struct connection *conn)
+{
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        r->connections = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    close(conn->fd);
+    packet_buffer_free(&conn->rx);
+    echo_queue_release(&conn->acks);
+    free(conn);
+}
+
+static void accept_connections(struct reactor *r)
+{
+    while (1) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(r->server_fd, (struct sockaddr *)&client_addr, &client_len,
+                                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return; // Backlog drained (or another reactor won the race)
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            syslog(LOG_ERR, "Failed to accept connection: %s", strerror(errno));
+            return;
+        }
+
+        uint64_t accepted_ns = metrics_now();
+        metrics_count(COUNTER_ACCEPTED, 1);
+        log_client_address(&client_addr);
+
+        struct connection *conn = calloc(1, sizeof(*conn));
+        if (!conn) {
+            syslog(LOG_ERR, "Failed to allocate memory");
+            close(client_fd);
+            continue;
+        }
+        conn->fd = client_fd;
+        conn->accepted_ns = accepted_ns;
+        conn->reactor = r;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        packet_buffer_init(&conn->rx);
+        echo_queue_init(&conn->acks);
+
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+            syslog(LOG_ERR, "epoll_ctl add failed: %s", strerror(errno));
+            close(client_fd);
+            free(conn);
+            continue;
+        }
+
+        conn->next = r->connections;
+        if (r->connections)
+            r->connections->prev = conn;
+        r->connections = conn;
+    }
+}
+
+// Send queued echoes; returns 1 when all are sent, 0 if the socket is full, -1 on error
+static int conn_flush(struct connection *conn)
+{
+    while (!echo_queue_empty(&conn->acks)) {
+        ssize_t sent = echo_queue_send(&conn->acks, conn->fd, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "send failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    return 1;
+}
+
+// Runs on the group commit writer thread: hand the connection back to its reactor
+static void conn_commit_complete(struct commit_request *req)
+{
+    struct connection *conn = req->arg;
+    struct reactor *r = conn->reactor;
+    uint64_t one = 1;
+
+    mpsc_push(&r->completions, &req->node);
+    if (write(r->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "Failed to wake reactor: %s", strerror(errno));
+}
+
+/**
+ * Queue the packets ready in rx on the group commit writer, or without -k the
+ * connection's one record.
+ * @return 1 if any were submitted, 0 if none were ready, -1 on error.
+ */
+static int conn_submit(struct connection *conn)
+{
+    int count;
+    if (config.persistent)
+        count = packet_collect(&conn->rx, conn->records, ECHO_QUEUE_DEPTH - conn->acks.count, conn->eof);
+    else
+        count = packet_collect_record(&conn->rx, conn->records, conn->eof);
+    if (count <= 0)
+        return count;
+
+    conn->commit = (struct commit_request) {
+        .records = conn->records,
+        .count = count,
+        .ends = conn->ends,
+        .complete = conn_commit_complete,
+        .arg = conn,
+    };
+    conn->committing = true;
+    conn->reactor->committing++;
+    commit_submit(&conn->commit);
+    return 1;
+}
+
+// Append the packets ready in rx, or without -k the connection's one record
+static int conn_append(struct connection *conn)
+{
+    if (config.persistent)
+        return packet_append_ready(&conn->rx, &conn->acks, conn->eof, ECHO_QUEUE_DEPTH);
+
+    int rc = packet_append_record(&conn->rx, &conn->acks, conn->eof);
+    if (rc > 0)
+        conn->packet_taken = conn->read_closed = true;
+    return rc;
+}
+
+/**
+ * Run the connection until it would block.
+ * Echoes are always flushed before more packets are appended, so a client that does not
+ * read its acknowledgements stops being read from instead of growing the queue.
+ * With group commit the packets are handed to the writer thread and the connection
+ * parks (committing) until conn_commit_complete() hands it back.
+ * @return 1 once the connection is finished, 0 to wait for epoll or the commit, -1 on error.
+ */
+static int conn_process(struct connection *conn)
+{
+    while (1) {
+        int rc = conn_flush(conn);
+        if (rc <= 0)
+            return rc;
+
+        // Without -k a connection carries one record, like the threaded handler
+        if (config.persistent || !conn->packet_taken) {
+            rc = config.group_commit ? conn_submit(conn) : conn_append(conn);
+            if (rc < 0)
+                return -1;
+            if (rc > 0 && config.group_commit)
+                return 0; // Parked until the writer has committed the packets
+            if (rc > 0)
+                continue;
+        }
+        if (conn->read_closed)
+            return 1;
+
+        size_t avail;
+        char *space = packet_buffer_reserve(&conn->rx, &avail);
+        if (!space)
+            return -1;
+        ssize_t bytes_read = recv(conn->fd, space, avail, 0);
+        if (bytes_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "recv failed: %s", strerror(errno));
+            return -1;
+        }
+        if (bytes_read > 0 && conn->accepted_ns) {
+            metrics_since(HIST_FIRST_BYTE, conn->accepted_ns);
+            conn->accepted_ns = 0;
+        }
+        if (bytes_read == 0) {
+            // Peer closed, append whatever we have like the threaded handler
+            conn->eof = true;
+            conn->read_closed = true;
+        }
+        packet_buffer_commit(&conn->rx, bytes_read);
+    }
+}
+
+static void conn_handle_event(struct reactor *r, struct connection *conn)
+{
+    if (conn->committing)
+        return; // The writer still references rx; resume from the completion
+
+    int rc = conn_process(conn);
+    if (rc != 0) {
+        conn_close(r, conn);
+        if (rc > 0)
+            log_client_closed();
+        return;
+    }
+
+    // Blocked on the writer, on a full socket (echoes pending) or on an empty one.
+    // A parked connection is left armed for one event only so a hangup cannot spin us.
+    uint32_t events = conn->committing ? EPOLLONESHOT :
+                      echo_queue_empty(&conn->acks) ? EPOLLIN | EPOLLRDHUP : EPOLLOUT;
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == -1) {
+            syslog(LOG_ERR, "epoll_ctl mod failed: %s", strerror(errno));
+            conn_close(r, conn);
+            return;
+        }
+        conn->events = events;
+    }
+}
+
+// Resume connections whose group commit has completed
+static void reactor_complete_commits(struct reactor *r, bool resume)
+{
+    uint64_t count;
+    struct mpsc_node *node;
+
+    if (read(r->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        syslog(LOG_ERR, "Failed to read reactor eventfd: %s", strerror(errno));
+
+    while ((node = mpsc_pop(&r->completions)) != NULL) {
+        struct commit_request *req = (struct commit_request *)node;
+        struct connection *conn = req->arg;
+
+        conn->committing = false;
+        r->committing--;
+        if (req->status < 0) {
+            conn_close(r, conn);
+            continue;
+        }
+        packet_accept(&conn->rx, &conn->acks, req->records, req->count, req->ends);
+        if (!config.persistent)
+            conn->packet_taken = conn->read_closed = true;
+        if (resume)
+            conn_handle_event(r, conn);
+    }
+}
+
+/**
+ * Hot restart (drain_flag): stop accepting, and close persistent connections as soon as
+ * they sit idle between packets.  @return true once no connection is left.
+ */
+static bool reactor_settle(struct reactor *r)
+{
+    if (!r->draining) {
+        r->draining = true;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, r->server_fd, NULL) == -1)
+            syslog(LOG_ERR, "epoll_ctl del listener failed: %s", strerror(errno));
+    }
+    for (struct connection *conn = r->connections, *next; conn; conn = next) {
+        next = conn->next;
+        if (config.persistent && !conn->committing && echo_queue_empty(&conn->acks) &&
+            packet_buffer_pending(&conn->rx) == 0) {
+            conn_close(r, conn);
+            log_client_closed();
+        }
+    }
+    return r->connections == NULL;
+}
+
+static void *reactor_thread(void *arg)
+{
+    struct reactor *r = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    pin_event_loop(r->index);
+
+    while (!stop_flag) {
+        if (drain_flag && reactor_settle(r))
+            break;
+        int n = epoll_wait(r->epoll_fd, events, MAX_EVENTS, EPOLL_TIMEOUT_MS);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue; // Interrupted by signal
+            syslog(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        // Completions may close connections that later events of this batch still point to,
+        // so they are only handled once the whole batch has been
+        bool woken = false;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL)
+                accept_connections(r);
+            else if (events[i].data.ptr == r)
+                woken = true;
+            else if (events[i].data.ptr == &r->timer_fd)
+                timestamp_timer_expired(r->timer_fd);
+            else
+                conn_handle_event(r, events[i].data.ptr);
+        }
+        if (woken)
+            reactor_complete_commits(r, true);
+    }
+
+    // The writer holds pointers into connections until their commits complete
+    while (r->committing > 0) {
+        struct pollfd pfd = { .fd = r->wake_fd, .events = POLLIN };
+        poll(&pfd, 1, EPOLL_TIMEOUT_MS);
+        reactor_complete_commits(r, false);
+    }
+
+    while (r->connections)
+        conn_close(r, r->connections);
+    return NULL;
+}
+
+static int reactor_init(struct reactor *r, int index, int server_fd, int timer_fd)
+{
+    memset(r, 0, sizeof(*r));
+    r->index = index;
+    r->server_fd = server_fd;
+    r->timer_fd = timer_fd;
+    mpsc_init(&r->completions);
+
+    r->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (r->wake_fd == -1) {
+        syslog(LOG_ERR, "eventfd failed: %s", strerror(errno));
+        return -1;
+    }
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd == -1) {
+        syslog(LOG_ERR, "epoll_create1 failed: %s", strerror(errno));
+        close(r->wake_fd);
+        return -1;
+    }
+
+    // data.ptr == r marks the commit completion eventfd
+    struct epoll_event wake_ev = { .events = EPOLLIN, .data.ptr = r };
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &wake_ev) == -1) {
+        syslog(LOG_ERR, "epoll_ctl add eventfd failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        close(r->wake_fd);
+        return -1;
+    }
+
+    // data.ptr == &r->timer_fd marks the timestamp timer
+    struct epoll_event timer_ev = { .events = EPOLLIN, .data.ptr = &r->timer_fd };
+    if (timer_fd != -1 && epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, timer_fd, &timer_ev) == -1) {
+        syslog(LOG_ERR, "epoll_ctl add timerfd failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        close(r->wake_fd);
+        return -1;
+    }
+
+    // EPOLLEXCLUSIVE avoids waking every reactor sharing a listener for each incoming connection
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
+        syslog(LOG_ERR, "epoll_ctl add listener failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        close(r->wake_fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void reactor_destroy(struct reactor *r)
+{
+    close(r->epoll_fd);
+    close(r->wake_fd);
+}
+
+int reactor_run(const int *server_fds, int num_listeners, int num_threads, int timer_fd)
+{
+    for (int i = 0; i < num_listeners; i++) {
+        int flags = fcntl(server_fds[i], F_GETFL, 0);
+        if (flags == -1 || fcntl(server_fds[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+            syslog(LOG_ERR, "Failed to make listening socket non-blocking: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    struct reactor *reactors = calloc(num_threads, sizeof(*reactors));
+    if (!reactors) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        return -1;
+    }
+
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (reactor_init(&reactors[started], started, server_fds[started % num_listeners],
+                         started == 0 ? timer_fd : -1) < 0)
+            break;
+        if (pthread_create(&reactors[started].tid, NULL, reactor_thread, &reactors[started]) != 0) {
+            syslog(LOG_ERR, "Failed to create reactor thread");
+            reactor_destroy(&reactors[started]);
+            break;
+        }
+    }
+
+    int rc = 0;
+    if (started < num_threads) {
+        stop_flag = 1;
+        rc = -1;
+    } else {
+        syslog(LOG_INFO, "Serving with %d epoll reactor threads", num_threads);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(reactors[i].tid, NULL);
+        reactor_destroy(&reactors[i]);
+    }
+    free(reactors);
+    return rc;
+}
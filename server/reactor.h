@@ -0,0 +1,15 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/**
+ * Serve connections with @param num_threads epoll reactor threads.  Reactor i waits on
+ * listening socket @param server_fds[i % @param num_listeners] (EPOLLEXCLUSIVE when shared)
+ * and drives its own non-blocking connections through the recv/append/echo cycle.  The
+ * first reactor also waits on @param timer_fd, the timestamp timer, unless it is -1.
+ * Blocks until stop_flag is set, or drain_flag is set and every connection has finished,
+ * and all reactors have exited.
+ * @return 0 on a clean shutdown, -1 if the reactors could not be started.
+ */
+int reactor_run(const int *server_fds, int num_listeners, int num_threads, int timer_fd);
+
+#endif /* REACTOR_H */
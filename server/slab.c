@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "aesdsocket.h"
+#include "slab.h"
+
+#define SLAB_CACHE_MAX 64    // Slabs kept by each thread before spilling to the pool
+#define SLAB_POOL_MAX 1024   // Slabs kept by the shared pool before freeing
+
+// Shared pool, refilled by threads spilling their caches and by exiting threads
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct slab *pool;
+static unsigned int pool_count;
+
+// Per-thread cache, taken and refilled without any lock
+static __thread struct slab *cache;
+static __thread unsigned int cache_count;
+
+// Hands a thread's cache back to the pool when the thread exits
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+// Move up to @param count slabs from the front of @param list to the pool, freeing the rest
+static void pool_put(struct slab *list, unsigned int count)
+{
+    pthread_mutex_lock(&pool_mutex);
+    while (list && count-- > 0) {
+        struct slab *next = list->next;
+        if (pool_count < SLAB_POOL_MAX) {
+            list->next = pool;
+            pool = list;
+            pool_count++;
+        } else {
+            free(list);
+        }
+        list = next;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static void cache_release(void *arg)
+{
+    (void)arg;
+    pool_put(cache, cache_count);
+    cache = NULL;
+    cache_count = 0;
+}
+
+static void cache_key_create(void)
+{
+    pthread_key_create(&cache_key, cache_release);
+}
+
+struct slab *slab_alloc(void)
+{
+    struct slab *slab = cache;
+
+    if (slab) {
+        cache = slab->next;
+        cache_count--;
+    } else {
+        pthread_mutex_lock(&pool_mutex);
+        slab = pool;
+        if (slab) {
+            pool = slab->next;
+            pool_count--;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    if (slab) {
+        atomic_fetch_add_explicit(&stats.slab_reused, 1, memory_order_relaxed);
+    } else {
+        slab = malloc(sizeof(*slab));
+        if (!slab) {
+            syslog(LOG_ERR, "Memory allocation failed");
+            return NULL;
+        }
+        atomic_fetch_add_explicit(&stats.slab_allocated, 1, memory_order_relaxed);
+    }
+    slab->next = NULL;
+    slab->len = 0;
+    return slab;
+}
+
+void slab_free(struct slab *slab)
+{
+    if (!slab)
+        return;
+
+    if (cache_count == 0) {
+        // First slab cached by this thread: make sure it is returned when the thread exits
+        pthread_once(&cache_key_once, cache_key_create);
+        pthread_setspecific(cache_key, &cache);
+    }
+
+    slab->next = cache;
+    cache = slab;
+    if (++cache_count < SLAB_CACHE_MAX)
+        return;
+
+    // Spill the older half, keeping the most recently used (cache-warm) slabs
+    struct slab *keep = cache;
+    for (unsigned int i = 1; i < SLAB_CACHE_MAX / 2; i++)
+        keep = keep->next;
+    struct slab *spill = keep->next;
+    keep->next = NULL;
+    cache_count = SLAB_CACHE_MAX / 2;
+    pool_put(spill, SLAB_CACHE_MAX - SLAB_CACHE_MAX / 2);
+}
+
+static void slab_free_list(struct slab *slab)
+{
+    while (slab) {
+        struct slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+}
+
+void slab_pool_drain(void)
+{
+    pthread_mutex_lock(&pool_mutex);
+    struct slab *slab = pool;
+    pool = NULL;
+    pool_count = 0;
+    pthread_mutex_unlock(&pool_mutex);
+    slab_free_list(slab);
+
+    // The calling thread's own cache too, whether or not the pool held anything
+    slab_free_list(cache);
+    cache = NULL;
+    cache_count = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_SIZE 4096 // Allocation size of one slab, header included
+#define SLAB_DATA_SIZE (SLAB_SIZE - 2 * sizeof(void *))
+
+/**
+ * Fixed-size receive buffer.  Connections chain slabs instead of growing one buffer with
+ * realloc(), so received bytes are never copied or moved until they are appended.
+ */
+struct slab {
+    struct slab *next;
+    size_t len;                 // Bytes of data[] in use
+    char data[SLAB_DATA_SIZE];
+};
+
+/**
+ * @return an empty slab, taken from the calling thread's cache, then from the shared pool,
+ * and only then from malloc(); NULL if memory could not be allocated.
+ */
+struct slab *slab_alloc(void);
+
+/**
+ * Return @param slab to the calling thread's cache.  A full cache spills half of its
+ * slabs to the shared pool, and slabs beyond the pool limit are freed, so slabs released
+ * by one connection are reused by the next without going back to malloc().
+ */
+void slab_free(struct slab *slab);
+
+// Free every slab held by the shared pool
+void slab_pool_drain(void);
+
+#endif /* SLAB_H */
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "timestamp.h"
+
+#define TIMESTAMP_FORMAT "timestamp:%a, %d %b %Y %H:%M:%S %z\n"
+
+// The last record formatted, reused while the wall clock second has not changed
+static char record[80];
+static size_t record_len;
+static time_t record_time = (time_t)-1;
+
+int timestamp_timer_open(long interval_ms)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        syslog(LOG_ERR, "timerfd_create failed: %s", strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = interval_ms / 1000, .tv_nsec = interval_ms % 1000 * 1000000 },
+    };
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
+        syslog(LOG_ERR, "timerfd_settime failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void timestamp_timer_expired(int timer_fd)
+{
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {
+        if (errno != EAGAIN) // Woken without a tick to read
+            syslog(LOG_ERR, "Failed to read timestamp timer: %s", strerror(errno));
+        return;
+    }
+
+    // Sub-second intervals would otherwise format the same string several times a second
+    time_t now = time(NULL);
+    if (now != record_time) {
+        struct tm tm_now;
+        record_len = strftime(record, sizeof(record), TIMESTAMP_FORMAT, localtime_r(&now, &tm_now));
+        record_time = now;
+    }
+
+    // Same append path as client packets
+    struct iovec iov = { .iov_base = record, .iov_len = record_len };
+    struct datalog_record rec = { .iov = &iov, .iovcnt = 1 };
+    commit_append(&rec, 1, NULL);
+}
@@ -0,0 +1,24 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+/**
+ * Periodic "timestamp:" records, driven by a timerfd that the server's event loop waits on
+ * next to the listening socket: the select() accept loop in thread and pool mode, the first
+ * epoll reactor or io_uring thread in those modes.  Nothing sleeps between ticks, so shutdown
+ * needs no cancellation.
+ */
+
+/**
+ * Create the timestamp timer, firing every @param interval_ms milliseconds.
+ * @return the timerfd to wait on for readability (close() it when done), or -1 on failure.
+ */
+int timestamp_timer_open(long interval_ms);
+
+/**
+ * Handle readability of the timestamp timer @param timer_fd: append one record through
+ * commit_append(), the append path of client packets.  Ticks missed while the loop was busy
+ * are coalesced into this one record.
+ */
+void timestamp_timer_expired(int timer_fd);
+
+#endif /* TIMESTAMP_H */
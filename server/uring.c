@@ -0,0 +1,872 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <poll.h>
+#include <syslog.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "aesdsocket.h"
+#include "commit.h"
+#include "echo.h"
+#include "metrics.h"
+#include "packet.h"
+#include "timestamp.h"
+#include "uring.h"
+
+#define URING_ENTRIES 256           // Submission queue entries per ring
+#define URING_CQ_ENTRIES 4096       // Completion queue entries; multishot requests post many
+#define URING_BUFFERS 256           // Provided receive buffers per ring, a power of two
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+#define URING_WRITE_IOV 1024        // IOV_MAX on Linux, per data file write
+#define URING_SEND_IOV 64           // iovec entries gathered into one echo sendmsg
+#define URING_RX_LIMIT (256 * 1024) // Stop receiving while echoes are pending past this many bytes
+#define URING_WAIT_MS 1000          // Wake up at least once a second to check stop_flag
+#define URING_DRAIN_MS 5000         // How long shutdown waits for cancelled requests
+
+// Files registered with every ring, in this order
+enum { URING_FILE_SERVER, URING_FILE_DATA };
+
+// Low bits of user_data; only RECV, SEND and WRITE carry a connection pointer in the rest
+enum uring_op {
+    URING_ACCEPT = 1,
+    URING_TIMER,
+    URING_RECV,
+    URING_SEND,
+    URING_WRITE,  // Data file write or fdatasync, only completes on failure
+    URING_CANCEL, // Cancellation, only completes on failure
+};
+#define URING_OP_MASK 7ull
+
+// Per-connection state for the recv/append/write/echo cycle
+struct uring_conn {
+    int fd;
+    bool eof;                // Peer closed its side
+    bool read_closed;        // Nothing more will be received from this connection
+    bool packet_taken;       // Without -k: its one record has been appended
+    bool recv_armed;         // A recv is in flight
+    bool recv_cancelling;    // and has been asked to stop
+    bool sending;            // A write/send chain or an echo sendmsg is in flight
+    bool closing;            // Freed as soon as nothing is in flight
+    uint64_t accepted_ns;    // metrics_now() at accept, cleared at the first byte
+    size_t consume;          // Bytes of rx covered by the write in flight
+    struct packet_buffer rx; // Bytes received but not yet appended
+    struct echo_queue acks;  // Echoes owed for appended packets, in order
+    struct datalog_record records[ECHO_QUEUE_DEPTH]; // Packets in rx being written
+    size_t ends[ECHO_QUEUE_DEPTH];
+    struct iovec send_iov[URING_SEND_IOV];
+    struct msghdr msg;       // Echo sendmsg in flight, over send_iov
+    struct uring_conn *prev;
+    struct uring_conn *next;
+};
+
+struct uring_worker {
+    pthread_t tid;
+    int index;                      // Position among the workers, for -C
+    int ring_fd;
+    int timer_fd;                   // Timestamp timer, -1 on all but the first worker
+    // Submission queue
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_local;          // Tail including entries not yet handed to the kernel
+    struct io_uring_sqe *sqes;
+    // Completion queue
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_len;
+    void *cq_map;
+    size_t cq_map_len;
+    size_t sqes_len;
+    // Provided receive buffers, registered as buffer group URING_BUFFER_GROUP
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_len;
+    char *buffers;
+    unsigned short buf_tail;
+
+    bool accept_armed;
+    bool timer_armed;
+    bool multishot_accept;          // Cleared if the kernel refuses multishot requests
+    bool multishot_recv;
+    bool multishot_poll;
+    bool draining;                  // drain_flag seen, no more accepts are armed
+    bool stopping;
+    struct uring_conn *connections; // Open connections owned by this worker
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                       const void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int ring_fd, unsigned int opcode, const void *arg, unsigned int nr_args)
+{
+    return syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+// Hand the queued entries to the kernel's view of the ring; @return how many it has not consumed
+static unsigned int uring_publish(struct uring_worker *w)
+{
+    __atomic_store_n(w->sq_tail, w->sq_local, __ATOMIC_RELEASE);
+    return w->sq_local - __atomic_load_n(w->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Make room for @param n entries, submitting what is queued if needed, so that a linked
+ * chain is never split across two submissions.  @return false if there is no room.
+ */
+static bool uring_sq_reserve(struct uring_worker *w, unsigned int n)
+{
+    if (w->sq_local - __atomic_load_n(w->sq_head, __ATOMIC_ACQUIRE) + n <= w->sq_entries)
+        return true;
+    if (uring_enter(w->ring_fd, uring_publish(w), 0, 0, NULL, 0) < 0 && errno != EINTR && errno != EBUSY)
+        syslog(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+    if (w->sq_local - __atomic_load_n(w->sq_head, __ATOMIC_ACQUIRE) + n <= w->sq_entries)
+        return true;
+    syslog(LOG_ERR, "io_uring submission queue full");
+    return false;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring_worker *w)
+{
+    if (!uring_sq_reserve(w, 1))
+        return NULL;
+    struct io_uring_sqe *sqe = &w->sqes[w->sq_local++ & w->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Submit what is queued and wait up to @param timeout_ms for at least one completion
+static int uring_wait(struct uring_worker *w, long timeout_ms)
+{
+    struct __kernel_timespec ts = { .tv_sec = timeout_ms / 1000, .tv_nsec = (timeout_ms % 1000) * 1000000L };
+    struct io_uring_getevents_arg arg = { .ts = (uintptr_t)&ts };
+
+    if (uring_enter(w->ring_fd, uring_publish(w), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                    &arg, sizeof(arg)) < 0 &&
+        errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+        syslog(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static bool uring_cancel(struct uring_worker *w, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(w);
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_CANCEL;
+    return true;
+}
+
+static void uring_arm_accept(struct uring_worker *w)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(w);
+    if (!sqe)
+        return; // Retried from the event loop
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = URING_FILE_SERVER;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (w->multishot_accept)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_ACCEPT;
+    w->accept_armed = true;
+}
+
+static void uring_arm_timer(struct uring_worker *w)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(w);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = w->timer_fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    sqe->poll32_events = (POLLIN << 16) | (POLLIN >> 16);
+#else
+    sqe->poll32_events = POLLIN;
+#endif
+    if (w->multishot_poll)
+        sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = URING_TIMER;
+    w->timer_armed = true;
+}
+
+static bool uring_arm_recv(struct uring_worker *w, struct uring_conn *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(w);
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    if (w->multishot_recv)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (uintptr_t)conn | URING_RECV;
+    conn->recv_armed = true;
+    return true;
+}
+
+// Queue a sendmsg of the pending echoes; the caller has reserved the entry
+static bool uring_conn_send(struct uring_worker *w, struct uring_conn *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(w);
+    if (!sqe)
+        return false;
+    int iovcnt = echo_queue_fill_iov(&conn->acks, conn->send_iov, URING_SEND_IOV);
+    conn->msg = (struct msghdr){ .msg_iov = conn->send_iov, .msg_iovlen = iovcnt };
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uintptr_t)&conn->msg;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)conn | URING_SEND;
+    conn->sending = true;
+    return true;
+}
+
+// Return provided buffer @param bid to the kernel
+static void uring_recycle_buffer(struct uring_worker *w, unsigned short bid)
+{
+    struct io_uring_buf *buf = &w->buf_ring->bufs[w->buf_tail & (URING_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t)(w->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    w->buf_tail++;
+    __atomic_store_n(&w->buf_ring->tail, w->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Free @param conn once it is closing and no request refers to it any more
+static void uring_conn_release(struct uring_worker *w, struct uring_conn *conn)
+{
+    if (conn->recv_armed || conn->sending)
+        return;
+
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        w->connections = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+
+    close(conn->fd);
+    packet_buffer_free(&conn->rx);
+    echo_queue_release(&conn->acks);
+    free(conn);
+}
+
+static void uring_conn_close(struct uring_worker *w, struct uring_conn *conn, bool finished)
+{
+    if (finished)
+        log_client_closed();
+    conn->closing = true;
+    if (conn->recv_armed && !conn->recv_cancelling) {
+        conn->recv_cancelling = true;
+        if (!uring_cancel(w, (uintptr_t)conn | URING_RECV))
+            shutdown(conn->fd, SHUT_RD); // Completes the recv instead
+    }
+    if (conn->sending)
+        shutdown(conn->fd, SHUT_RDWR); // Do not wait for a peer that stopped reading
+    uring_conn_release(w, conn);
+}
+
+/**
+ * Append the packets ready in rx, then queue their write to the data file linked to
+ * (an fdatasync with -f, then) the sendmsg of their echoes, so the echo only leaves once
+ * the packets are in the file.  The records are published from memory right away.
+ * @return 1 once the connection is finished, 0 to wait for completions, -1 on error.
+ */
+static int uring_conn_process(struct uring_worker *w, struct uring_conn *conn)
+{
+    // Without -k a connection carries one record, like the threaded handler
+    int count = 0;
+    if (config.persistent)
+        count = packet_collect(&conn->rx, conn->records, ECHO_QUEUE_DEPTH, conn->eof);
+    else if (!conn->packet_taken)
+        count = packet_collect_record(&conn->rx, conn->records, conn->eof);
+    if (count <= 0)
+        return count < 0 ? -1 : conn->read_closed;
+
+    // The chain is submitted at once, so it must fit the ring: leave the packets that do not
+    // for the next chain.  Its entries are reserved before the records are published, as a
+    // record published without its write would leave a hole in the data file.
+    unsigned int iovcnt = 0, writes = 0;
+    bool sync = false;
+    int fit;
+    for (fit = 0; fit < count; fit++) {
+        unsigned int n = iovcnt + conn->records[fit].iovcnt;
+        unsigned int need_writes = data_log.fd != -1 ? (n + URING_WRITE_IOV - 1) / URING_WRITE_IOV : 0;
+        bool need_sync = need_writes > 0 && config.commit_sync;
+        if (need_writes + need_sync + 1 > w->sq_entries)
+            break;
+        iovcnt = n;
+        writes = need_writes;
+        sync = need_sync;
+    }
+    if (fit == 0) {
+        syslog(LOG_ERR, "Packet too large for the io_uring submission queue");
+        return -1;
+    }
+    count = fit;
+    if (!uring_sq_reserve(w, writes + sync + 1))
+        return -1;
+
+    size_t offset, len = 0;
+    if (commit_append_deferred(conn->records, count, conn->ends, &offset) < 0)
+        return -1;
+    if (!config.persistent)
+        conn->packet_taken = conn->read_closed = true;
+    for (int i = 0; i < count; i++) {
+        for (unsigned int b = 0; b < conn->records[i].iovcnt; b++)
+            len += conn->records[i].iov[b].iov_len;
+        echo_queue_push(&conn->acks, conn->ends[i]);
+    }
+    conn->consume = len;
+
+    // The records collected lay their pieces out back to back
+    const struct iovec *iov = conn->records[0].iov;
+    for (unsigned int i = 0; i < writes; i++) {
+        unsigned int n = iovcnt - i * URING_WRITE_IOV;
+        if (n > URING_WRITE_IOV)
+            n = URING_WRITE_IOV;
+        struct io_uring_sqe *sqe = uring_get_sqe(w);
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = URING_FILE_DATA;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+        sqe->addr = (uintptr_t)iov;
+        sqe->len = n;
+        sqe->off = offset;
+        sqe->user_data = (uintptr_t)conn | URING_WRITE;
+        for (unsigned int b = 0; b < n; b++)
+            offset += iov[b].iov_len;
+        iov += n;
+    }
+    if (sync) {
+        struct io_uring_sqe *sqe = uring_get_sqe(w);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = URING_FILE_DATA;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = (uintptr_t)conn | URING_WRITE;
+    }
+    uring_conn_send(w, conn);
+    return 0;
+}
+
+/**
+ * Move the connection on after a completion: append what is ready unless a chain is in
+ * flight, and keep a recv armed unless the echoes are backing up.
+ */
+static void uring_conn_run(struct uring_worker *w, struct uring_conn *conn)
+{
+    if (!conn->sending) {
+        int rc = uring_conn_process(w, conn);
+        if (rc != 0) {
+            uring_conn_close(w, conn, rc > 0);
+            return;
+        }
+    }
+    if (!conn->recv_armed && !conn->read_closed &&
+        !(conn->sending && packet_buffer_pending(&conn->rx) >= URING_RX_LIMIT) &&
+        !uring_arm_recv(w, conn))
+        uring_conn_close(w, conn, false);
+}
+
+static void uring_accepted(struct uring_worker *w, const struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        w->accept_armed = false; // Re-armed from the event loop
+    if (cqe->res < 0) {
+        if (cqe->res == -EINVAL && w->multishot_accept) {
+            syslog(LOG_INFO, "Multishot accept unsupported, accepting one connection per request");
+            w->multishot_accept = false;
+        } else if (cqe->res != -ECANCELED && cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+            syslog(LOG_ERR, "Failed to accept connection: %s", strerror(-cqe->res));
+        }
+        return;
+    }
+
+    int client_fd = cqe->res;
+    if (w->stopping) {
+        close(client_fd);
+        return;
+    }
+    uint64_t accepted_ns = metrics_now();
+    metrics_count(COUNTER_ACCEPTED, 1);
+    struct sockaddr_storage client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    if (getpeername(client_fd, (struct sockaddr *)&client_addr, &client_len) == 0)
+        log_client_address(&client_addr);
+
+    struct uring_conn *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        close(client_fd);
+        return;
+    }
+    conn->fd = client_fd;
+    conn->accepted_ns = accepted_ns;
+    packet_buffer_init(&conn->rx);
+    echo_queue_init(&conn->acks);
+
+    conn->next = w->connections;
+    if (w->connections)
+        w->connections->prev = conn;
+    w->connections = conn;
+    uring_conn_run(w, conn);
+}
+
+// Copy @param len received bytes out of a provided buffer into rx
+static int uring_conn_store(struct uring_conn *conn, const char *data, size_t len)
+{
+    if (conn->accepted_ns) {
+        metrics_since(HIST_FIRST_BYTE, conn->accepted_ns);
+        conn->accepted_ns = 0;
+    }
+    while (len > 0) {
+        size_t avail;
+        char *space = packet_buffer_reserve(&conn->rx, &avail);
+        if (!space)
+            return -1;
+        if (avail > len)
+            avail = len;
+        memcpy(space, data, avail);
+        packet_buffer_commit(&conn->rx, avail);
+        data += avail;
+        len -= avail;
+    }
+    return 0;
+}
+
+static void uring_received(struct uring_worker *w, struct uring_conn *conn, const struct io_uring_cqe *cqe)
+{
+    int res = cqe->res;
+    bool failed = false;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->recv_armed = false;
+        conn->recv_cancelling = false;
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0 && !conn->closing)
+            failed = uring_conn_store(conn, w->buffers + (size_t)bid * URING_BUFFER_SIZE, res) < 0;
+        uring_recycle_buffer(w, bid);
+    }
+    if (conn->closing) {
+        uring_conn_release(w, conn);
+        return;
+    }
+
+    if (res == 0) {
+        // Peer closed, append whatever we have like the threaded handler
+        conn->eof = true;
+        conn->read_closed = true;
+    } else if (res == -EINVAL && w->multishot_recv) {
+        syslog(LOG_INFO, "Multishot recv unsupported, receiving once per request");
+        w->multishot_recv = false;
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        syslog(LOG_ERR, "recv failed: %s", strerror(-res));
+        failed = true;
+    }
+    if (failed) {
+        uring_conn_close(w, conn, false);
+        return;
+    }
+
+    // A client that does not read its echoes stops being read from
+    if (conn->recv_armed && !conn->recv_cancelling && conn->sending &&
+        packet_buffer_pending(&conn->rx) >= URING_RX_LIMIT && uring_cancel(w, (uintptr_t)conn | URING_RECV))
+        conn->recv_cancelling = true;
+    uring_conn_run(w, conn);
+}
+
+static void uring_sent(struct uring_worker *w, struct uring_conn *conn, int res)
+{
+    conn->sending = false;
+    if (conn->consume) {
+        packet_buffer_consume(&conn->rx, conn->consume);
+        conn->consume = 0;
+    }
+    if (conn->closing) {
+        uring_conn_release(w, conn);
+        return;
+    }
+    // -ECANCELED: the data file write linked before the send failed (see uring_write_failed())
+    if (res < 0 || (res == 0 && conn->msg.msg_iovlen > 0)) {
+        if (res != -ECANCELED)
+            syslog(LOG_ERR, "send failed: %s", res < 0 ? strerror(-res) : "no progress");
+        uring_conn_close(w, conn, false);
+        return;
+    }
+
+    echo_queue_advance(&conn->acks, res);
+    if (!echo_queue_empty(&conn->acks)) {
+        if (!uring_conn_send(w, conn))
+            uring_conn_close(w, conn, false);
+        return;
+    }
+    uring_conn_run(w, conn);
+}
+
+/**
+ * A data file write or fdatasync of the connection's chain failed (they only complete then).
+ * Its records are already published and later appends were placed after them, so the file
+ * can no longer match the log: refuse every further append.  The requests linked after the
+ * failed one, the echo sendmsg included, are cancelled without completions of their own
+ * (IOSQE_CQE_SKIP_SUCCESS), so this ends the chain.
+ */
+static void uring_write_failed(struct uring_worker *w, struct uring_conn *conn, int res)
+{
+    if (res >= 0)
+        syslog(LOG_ERR, "Short write to data file");
+    else
+        syslog(LOG_ERR, "Failed to write data file: %s", strerror(-res));
+    pthread_mutex_lock(&file_mutex);
+    datalog_fail(&data_log);
+    pthread_mutex_unlock(&file_mutex);
+    uring_sent(w, conn, -ECANCELED);
+}
+
+static void uring_complete(struct uring_worker *w, const struct io_uring_cqe *cqe)
+{
+    struct uring_conn *conn = (struct uring_conn *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+
+    switch (cqe->user_data & URING_OP_MASK) {
+    case URING_ACCEPT:
+        uring_accepted(w, cqe);
+        break;
+    case URING_TIMER:
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            w->timer_armed = false;
+        if (cqe->res == -EINVAL && w->multishot_poll)
+            w->multishot_poll = false;
+        else if (cqe->res < 0 && cqe->res != -ECANCELED)
+            syslog(LOG_ERR, "Timestamp timer poll failed: %s", strerror(-cqe->res));
+        else if (cqe->res > 0)
+            timestamp_timer_expired(w->timer_fd);
+        break;
+    case URING_RECV:
+        uring_received(w, conn, cqe);
+        break;
+    case URING_SEND:
+        uring_sent(w, conn, cqe->res);
+        break;
+    case URING_WRITE:
+        uring_write_failed(w, conn, cqe->res);
+        break;
+    case URING_CANCEL:
+        break; // Already complete (-ENOENT) or about to (-EALREADY)
+    }
+}
+
+static void uring_reap(struct uring_worker *w)
+{
+    unsigned int head = *w->cq_head;
+    unsigned int tail = __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe cqe = w->cqes[head & w->cq_mask];
+        __atomic_store_n(w->cq_head, ++head, __ATOMIC_RELEASE);
+        uring_complete(w, &cqe);
+        if (head == tail)
+            tail = __atomic_load_n(w->cq_tail, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Cancel everything and wait for the cancellations, so no request outlives its connection
+static void uring_drain(struct uring_worker *w)
+{
+    w->stopping = true;
+    if (w->accept_armed)
+        uring_cancel(w, URING_ACCEPT);
+    if (w->timer_armed)
+        uring_cancel(w, URING_TIMER);
+    for (struct uring_conn *conn = w->connections, *next; conn; conn = next) {
+        next = conn->next;
+        if (!conn->closing)
+            uring_conn_close(w, conn, false);
+    }
+
+    for (long waited = 0; (w->connections || w->accept_armed || w->timer_armed) && waited < URING_DRAIN_MS;
+         waited += 100) {
+        if (uring_wait(w, 100) < 0)
+            break;
+        uring_reap(w);
+    }
+}
+
+/**
+ * Hot restart (drain_flag): stop accepting, and close persistent connections as soon as
+ * they sit idle between packets.  @return true once no connection or accept is left.
+ */
+static bool uring_settle(struct uring_worker *w)
+{
+    if (!w->draining)
+        w->draining = !w->accept_armed || uring_cancel(w, URING_ACCEPT); // Else retried next time
+    for (struct uring_conn *conn = w->connections, *next; conn; conn = next) {
+        next = conn->next;
+        if (config.persistent && !conn->closing && !conn->sending && echo_queue_empty(&conn->acks) &&
+            packet_buffer_pending(&conn->rx) == 0)
+            uring_conn_close(w, conn, true);
+    }
+    return !w->connections && !w->accept_armed;
+}
+
+static void *uring_thread(void *arg)
+{
+    struct uring_worker *w = arg;
+
+    pin_event_loop(w->index);
+    // The ring was created disabled; enabling it here makes this thread its only submitter
+    if (uring_register(w->ring_fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0) {
+        syslog(LOG_ERR, "Failed to enable io_uring: %s", strerror(errno));
+        stop_flag = 1;
+        return NULL;
+    }
+
+    while (!stop_flag) {
+        if (drain_flag && uring_settle(w))
+            break;
+        if (!w->accept_armed && !w->draining)
+            uring_arm_accept(w);
+        if (w->timer_fd != -1 && !w->timer_armed)
+            uring_arm_timer(w);
+        if (uring_wait(w, URING_WAIT_MS) < 0)
+            break;
+        uring_reap(w);
+    }
+    uring_drain(w);
+    return NULL;
+}
+
+static void uring_worker_destroy(struct uring_worker *w)
+{
+    if (w->ring_fd != -1)
+        close(w->ring_fd); // Cancels whatever the drain gave up on
+    // Left over only if the drain timed out; the ring is gone, so nothing refers to them
+    while (w->connections) {
+        w->connections->recv_armed = false;
+        w->connections->sending = false;
+        uring_conn_release(w, w->connections);
+    }
+    if (w->sqes)
+        munmap(w->sqes, w->sqes_len);
+    if (w->cq_map && w->cq_map != w->sq_map)
+        munmap(w->cq_map, w->cq_map_len);
+    if (w->sq_map)
+        munmap(w->sq_map, w->sq_map_len);
+    if (w->buf_ring)
+        munmap(w->buf_ring, w->buf_ring_len);
+    free(w->buffers);
+}
+
+static int uring_map(struct uring_worker *w, const struct io_uring_params *p)
+{
+    w->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+    w->cq_map_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        if (w->cq_map_len > w->sq_map_len)
+            w->sq_map_len = w->cq_map_len;
+        w->cq_map_len = w->sq_map_len;
+    }
+
+    w->sq_map = mmap(NULL, w->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     w->ring_fd, IORING_OFF_SQ_RING);
+    if (w->sq_map == MAP_FAILED) {
+        w->sq_map = NULL;
+        return -1;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        w->cq_map = w->sq_map;
+    } else {
+        w->cq_map = mmap(NULL, w->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         w->ring_fd, IORING_OFF_CQ_RING);
+        if (w->cq_map == MAP_FAILED) {
+            w->cq_map = NULL;
+            return -1;
+        }
+    }
+    w->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    w->sqes = mmap(NULL, w->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   w->ring_fd, IORING_OFF_SQES);
+    if (w->sqes == MAP_FAILED) {
+        w->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = w->sq_map, *cq = w->cq_map;
+    w->sq_head = (unsigned int *)(sq + p->sq_off.head);
+    w->sq_tail = (unsigned int *)(sq + p->sq_off.tail);
+    w->sq_mask = *(unsigned int *)(sq + p->sq_off.ring_mask);
+    w->sq_entries = p->sq_entries;
+    w->sq_local = *w->sq_tail;
+    unsigned int *array = (unsigned int *)(sq + p->sq_off.array);
+    for (unsigned int i = 0; i < p->sq_entries; i++)
+        array[i] = i; // Entries are used in ring order
+    w->cq_head = (unsigned int *)(cq + p->cq_off.head);
+    w->cq_tail = (unsigned int *)(cq + p->cq_off.tail);
+    w->cq_mask = *(unsigned int *)(cq + p->cq_off.ring_mask);
+    w->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+// Register the provided buffer ring and fill it; @return 0, -1, or URING_UNAVAILABLE
+static int uring_setup_buffers(struct uring_worker *w)
+{
+    w->buf_ring_len = URING_BUFFERS * sizeof(struct io_uring_buf);
+    w->buf_ring = mmap(NULL, w->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (w->buf_ring == MAP_FAILED) {
+        w->buf_ring = NULL;
+        syslog(LOG_ERR, "Failed to map io_uring buffer ring: %s", strerror(errno));
+        return -1;
+    }
+    w->buffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if (!w->buffers) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uintptr_t)w->buf_ring,
+        .ring_entries = URING_BUFFERS,
+        .bgid = URING_BUFFER_GROUP,
+    };
+    if (uring_register(w->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        syslog(LOG_INFO, "io_uring provided buffer rings unsupported: %s", strerror(errno));
+        return URING_UNAVAILABLE;
+    }
+    for (unsigned short bid = 0; bid < URING_BUFFERS; bid++)
+        uring_recycle_buffer(w, bid);
+    return 0;
+}
+
+// @return 0 on success, -1 on failure or URING_UNAVAILABLE, with @param w cleaned up
+static int uring_worker_init(struct uring_worker *w, int index, int server_fd, int timer_fd)
+{
+    // Created disabled so that the worker thread, not this one, becomes the single issuer
+    static const unsigned int setup_flags[] = {
+        IORING_SETUP_R_DISABLED | IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL |
+            IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_R_DISABLED | IORING_SETUP_CQSIZE,
+    };
+    struct io_uring_params params;
+
+    memset(w, 0, sizeof(*w));
+    w->index = index;
+    w->timer_fd = timer_fd;
+    w->multishot_accept = w->multishot_recv = w->multishot_poll = true;
+    w->ring_fd = -1;
+    for (size_t i = 0; i < sizeof(setup_flags) / sizeof(setup_flags[0]) && w->ring_fd == -1; i++) {
+        memset(&params, 0, sizeof(params));
+        params.flags = setup_flags[i];
+        params.cq_entries = URING_CQ_ENTRIES;
+        w->ring_fd = uring_setup(URING_ENTRIES, &params);
+        if (w->ring_fd == -1 && errno != EINVAL)
+            break;
+    }
+    if (w->ring_fd == -1) {
+        syslog(LOG_INFO, "io_uring unavailable: %s", strerror(errno));
+        return URING_UNAVAILABLE;
+    }
+    // The event loop relies on waiting with a timeout and on no completion being dropped
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+        syslog(LOG_INFO, "io_uring lacks wait timeouts or overflow protection");
+        uring_worker_destroy(w);
+        return URING_UNAVAILABLE;
+    }
+
+    if (uring_map(w, &params) < 0) {
+        syslog(LOG_ERR, "Failed to map io_uring: %s", strerror(errno));
+        uring_worker_destroy(w);
+        return -1;
+    }
+
+    int files[] = { [URING_FILE_SERVER] = server_fd, [URING_FILE_DATA] = data_log.fd };
+    if (uring_register(w->ring_fd, IORING_REGISTER_FILES, files, data_log.fd != -1 ? 2 : 1) < 0) {
+        syslog(LOG_ERR, "Failed to register files with io_uring: %s", strerror(errno));
+        uring_worker_destroy(w);
+        return -1;
+    }
+
+    int rc = uring_setup_buffers(w);
+    if (rc != 0)
+        uring_worker_destroy(w);
+    return rc;
+}
+
+int uring_run(const int *server_fds, int num_listeners, int num_threads, int timer_fd)
+{
+    struct uring_worker *workers = calloc(num_threads, sizeof(*workers));
+    if (!workers) {
+        syslog(LOG_ERR, "Failed to allocate memory");
+        return -1;
+    }
+
+    int ready = 0, rc = 0;
+    for (; ready < num_threads; ready++) {
+        rc = uring_worker_init(&workers[ready], ready, server_fds[ready % num_listeners],
+                               ready == 0 ? timer_fd : -1);
+        if (rc != 0)
+            break;
+    }
+    if (rc != 0) {
+        // Nothing has been started yet, so the caller may still serve another way
+        for (int i = 0; i < ready; i++)
+            uring_worker_destroy(&workers[i]);
+        free(workers);
+        return rc;
+    }
+
+    // Echoes are sent from the in-memory log by the rings; sendfile() would block them
+    config.zero_copy = false;
+
+    int started = 0;
+    for (; started < num_threads; started++) {
+        if (pthread_create(&workers[started].tid, NULL, uring_thread, &workers[started]) != 0) {
+            syslog(LOG_ERR, "Failed to create io_uring thread");
+            break;
+        }
+    }
+
+    if (started < num_threads) {
+        stop_flag = 1;
+        rc = -1;
+    } else {
+        syslog(LOG_INFO, "Serving with %d io_uring threads", num_threads);
+    }
+
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].tid, NULL);
+    for (int i = 0; i < num_threads; i++)
+        uring_worker_destroy(&workers[i]);
+    free(workers);
+    return rc;
+}
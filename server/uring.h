@@ -0,0 +1,20 @@
+#ifndef URING_H
+#define URING_H
+
+/**
+ * Serve connections with @param num_threads io_uring threads, each driving its own ring:
+ * a multishot accept on its listening socket, a multishot recv per connection into a
+ * provided buffer ring, and per batch of packets a data file write linked to (fdatasync
+ * with -f and) the echo sendmsg.  Thread i listens on @param server_fds[i % @param
+ * num_listeners]; its listening socket and the data file are registered with its ring.
+ * The first thread also polls @param timer_fd, the timestamp timer, unless it is -1.
+ * Blocks until stop_flag is set, or drain_flag is set and every connection has finished,
+ * and all threads have exited.
+ * @return 0 on a clean shutdown, -1 if the threads could not be started, or
+ *      URING_UNAVAILABLE (nothing was started) if the kernel lacks what the rings need.
+ */
+int uring_run(const int *server_fds, int num_listeners, int num_threads, int timer_fd);
+
+#define URING_UNAVAILABLE 1
+
+#endif /* URING_H */
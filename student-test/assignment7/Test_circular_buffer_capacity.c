@@ -0,0 +1,77 @@
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+#define CAPACITY 20 // Not a power of two and more than the embedded slots: 32 allocated slots
+#define WRITES 50   // Enough to wrap around the slots
+
+static char strings[WRITES][16];
+
+// Entries of varying size, so lookups depend on the offsets of every entry before them
+static struct aesd_buffer_entry make_entry(int i)
+{
+    int len = snprintf(strings[i], sizeof(strings[i]), "write%d%.*s\n", i, i % 4, "xxx");
+    return (struct aesd_buffer_entry) { .buffptr = strings[i], .size = len };
+}
+
+void test_circular_buffer_capacity_wrap()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[1];
+    struct aesd_buffer_entry *entry;
+    struct iovec iov[CAPACITY];
+    unsigned int index;
+    size_t offset, bytes, total = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, CAPACITY));
+    TEST_ASSERT_TRUE(buffer.entry != buffer.entry_storage);
+    for (int i = 0; i < WRITES; i++) {
+        struct aesd_buffer_entry add = make_entry(i);
+        if (i < CAPACITY) {
+            TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_add_entry_evict(&buffer, &add, evicted, 1));
+        } else {
+            TEST_ASSERT_EQUAL_INT(1, aesd_circular_buffer_add_entry_evict(&buffer, &add, evicted, 1));
+            TEST_ASSERT_EQUAL_PTR(strings[i - CAPACITY], evicted[0].buffptr);
+        }
+    }
+    TEST_ASSERT_EQUAL_UINT(CAPACITY, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_TRUE(buffer.out_offs > buffer.in_offs); // The entries wrap around the end of the slots
+
+    // Oldest first, and every byte is found in its entry across the wrap
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &buffer, index) {
+        TEST_ASSERT_EQUAL_PTR(strings[WRITES - CAPACITY + index], entry->buffptr);
+        TEST_ASSERT_EQUAL_PTR(entry, aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total, &offset));
+        TEST_ASSERT_EQUAL_UINT(0, offset);
+        TEST_ASSERT_EQUAL_PTR(entry,
+                aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total + entry->size - 1, &offset));
+        TEST_ASSERT_EQUAL_UINT(entry->size - 1, offset);
+        total += entry->size;
+    }
+    TEST_ASSERT_EQUAL_UINT(total, aesd_circular_buffer_total_size(&buffer));
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total, &offset));
+
+    // Looked up in reverse, so the hint from the previous lookup does not help
+    for (int i = CAPACITY - 1; i >= 0; i--) {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, total - 1, &offset);
+        TEST_ASSERT_EQUAL_PTR(strings[WRITES - CAPACITY + i], entry->buffptr);
+        total -= offset + 1;
+    }
+    TEST_ASSERT_EQUAL_UINT(0, total);
+
+    TEST_ASSERT_EQUAL_UINT(CAPACITY, aesd_circular_buffer_fill_iovec(&buffer, 0, ~(size_t)0, iov, CAPACITY, &bytes));
+    TEST_ASSERT_EQUAL_UINT(aesd_circular_buffer_total_size(&buffer), bytes);
+    TEST_ASSERT_EQUAL_PTR(strings[WRITES - CAPACITY], iov[0].iov_base);
+    TEST_ASSERT_EQUAL_PTR(strings[WRITES - 1], iov[CAPACITY - 1].iov_base);
+
+    // Freed back to an empty buffer with the embedded slots, which is usable again
+    aesd_circular_buffer_free(&buffer);
+    TEST_ASSERT_TRUE(buffer.entry == buffer.entry_storage);
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_total_size(&buffer));
+    struct aesd_buffer_entry add = make_entry(0);
+    aesd_circular_buffer_add_entry(&buffer, &add);
+    TEST_ASSERT_EQUAL_PTR(strings[0], aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &offset)->buffptr);
+    aesd_circular_buffer_free(&buffer);
+}
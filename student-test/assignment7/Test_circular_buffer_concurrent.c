@@ -0,0 +1,156 @@
+#include "unity.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer-concurrent.h"
+
+#define STRESS_CAPACITY 64
+// Entry buffers are recycled two entries after their entry is evicted, so slow readers race with reuse
+#define STRESS_BUFFERS (STRESS_CAPACITY + 2)
+#define STRESS_MAX_SIZE 48
+#define STRESS_ENTRIES 200000
+#define STRESS_READERS 4
+
+// Expected value of the byte at stream offset @param offset
+static char stream_byte(size_t offset)
+{
+    return (char)(offset * 131 + 7);
+}
+
+struct stress_state {
+    struct aesd_concurrent_buffer buffer;
+    char buffers[STRESS_BUFFERS][STRESS_MAX_SIZE];
+    size_t end_offset;      // Published by the writer after each add
+    bool done;
+};
+
+struct reader_result {
+    struct stress_state *state;
+    unsigned int seed;
+    unsigned long ok;
+    unsigned long stale;
+    unsigned long corrupt;
+};
+
+static void *stress_writer(void *arg)
+{
+    struct stress_state *state = arg;
+    size_t offset = 0;
+
+    for (unsigned long n = 0; n < STRESS_ENTRIES; n++) {
+        char *data = state->buffers[n % STRESS_BUFFERS];
+        size_t size = n % STRESS_MAX_SIZE; // Includes empty entries
+        for (size_t i = 0; i < size; i++)
+            data[i] = stream_byte(offset + i);
+
+        struct aesd_buffer_entry entry = { .buffptr = data, .size = size };
+        aesd_concurrent_buffer_add_entry(&state->buffer, &entry, NULL);
+        offset += size;
+        __atomic_store_n(&state->end_offset, offset, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&state->done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *stress_reader(void *arg)
+{
+    struct reader_result *result = arg;
+    struct stress_state *state = result->state;
+    char copy[STRESS_MAX_SIZE];
+
+    while (!__atomic_load_n(&state->done, __ATOMIC_ACQUIRE)) {
+        size_t end = __atomic_load_n(&state->end_offset, __ATOMIC_ACQUIRE);
+        if (end == 0)
+            continue;
+        // Mostly recent offsets, where the writer is busy evicting and reusing buffers
+        size_t window = STRESS_CAPACITY * STRESS_MAX_SIZE;
+        size_t span = end < window ? end : window;
+        size_t offset = end - 1 - rand_r(&result->seed) % span;
+
+        ssize_t copied = aesd_concurrent_buffer_read(&state->buffer, offset, copy, sizeof(copy));
+        if (copied == -ESTALE) {
+            result->stale++;
+            continue;
+        }
+        if (copied <= 0) {
+            result->corrupt++; // Offsets below end were published and must be found or stale
+            continue;
+        }
+        result->ok++;
+        for (ssize_t i = 0; i < copied; i++) {
+            if (copy[i] != stream_byte(offset + i)) {
+                result->corrupt++;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+void test_concurrent_buffer_lookup()
+{
+    struct aesd_concurrent_buffer buffer;
+    struct aesd_concurrent_ref ref;
+    struct aesd_buffer_entry evicted;
+    const char *strings[] = { "write1\n", "write2\n", "", "write4\n", "write5\n" };
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_init(&buffer, 3)); // Rounded up to 4 entries
+    TEST_ASSERT_EQUAL_INT(-ENOENT, aesd_concurrent_buffer_find(&buffer, 0, &ref));
+
+    for (int i = 0; i < 4; i++) {
+        struct aesd_buffer_entry entry = { .buffptr = strings[i], .size = strlen(strings[i]) };
+        TEST_ASSERT_FALSE(aesd_concurrent_buffer_add_entry(&buffer, &entry, &evicted));
+    }
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_find(&buffer, 0, &ref));
+    TEST_ASSERT_EQUAL_PTR(strings[0], ref.entry.buffptr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_find(&buffer, 14, &ref));
+    TEST_ASSERT_EQUAL_PTR(strings[3], ref.entry.buffptr); // Skips the empty entry
+    TEST_ASSERT_EQUAL_UINT(14, ref.start);
+    TEST_ASSERT_EQUAL_INT(-ENOENT, aesd_concurrent_buffer_find(&buffer, 21, &ref));
+
+    struct aesd_buffer_entry entry = { .buffptr = strings[4], .size = strlen(strings[4]) };
+    TEST_ASSERT_TRUE(aesd_concurrent_buffer_add_entry(&buffer, &entry, &evicted));
+    TEST_ASSERT_EQUAL_PTR(strings[0], evicted.buffptr);
+    TEST_ASSERT_EQUAL_INT(-ESTALE, aesd_concurrent_buffer_find(&buffer, 6, &ref));
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_find(&buffer, 7, &ref));
+    TEST_ASSERT_EQUAL_PTR(strings[1], ref.entry.buffptr);
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_next(&buffer, &ref));
+    TEST_ASSERT_EQUAL_PTR(strings[2], ref.entry.buffptr);
+    TEST_ASSERT_TRUE(aesd_concurrent_buffer_valid(&buffer, &ref));
+
+    char copy[8] = { 0 };
+    TEST_ASSERT_EQUAL_INT(4, aesd_concurrent_buffer_read(&buffer, 24, copy, sizeof(copy)));
+    TEST_ASSERT_EQUAL_STRING("te5\n", copy);
+    aesd_concurrent_buffer_free(&buffer);
+}
+
+void test_concurrent_buffer_stress()
+{
+    static struct stress_state state;
+    struct reader_result results[STRESS_READERS];
+    pthread_t readers[STRESS_READERS];
+    pthread_t writer;
+    unsigned long ok = 0, stale = 0, corrupt = 0;
+
+    memset(&state, 0, sizeof(state));
+    TEST_ASSERT_EQUAL_INT(0, aesd_concurrent_buffer_init(&state.buffer, STRESS_CAPACITY));
+    for (int i = 0; i < STRESS_READERS; i++) {
+        results[i] = (struct reader_result) { .state = &state, .seed = i + 1 };
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&readers[i], NULL, stress_reader, &results[i]));
+    }
+    TEST_ASSERT_EQUAL_INT(0, pthread_create(&writer, NULL, stress_writer, &state));
+
+    pthread_join(writer, NULL);
+    for (int i = 0; i < STRESS_READERS; i++) {
+        pthread_join(readers[i], NULL);
+        ok += results[i].ok;
+        stale += results[i].stale;
+        corrupt += results[i].corrupt;
+    }
+    aesd_concurrent_buffer_free(&state.buffer);
+
+    TEST_ASSERT_EQUAL_UINT_MESSAGE(0, corrupt, "A validated read returned bytes of another entry");
+    TEST_ASSERT_TRUE_MESSAGE(ok + stale > 0, "Readers made no progress");
+}
@@ -0,0 +1,66 @@
+#include "unity.h"
+#include <errno.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+static struct aesd_buffer_entry make_entry(const char *str)
+{
+    return (struct aesd_buffer_entry) { .buffptr = str, .size = strlen(str) };
+}
+
+void test_circular_buffer_evict_by_count()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[3];
+    const char *strings[] = { "write1\n", "write2\n", "write3\n", "write4\n" };
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, 3));
+    for (int i = 0; i < 3; i++) {
+        struct aesd_buffer_entry entry = make_entry(strings[i]);
+        TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 3));
+    }
+    struct aesd_buffer_entry entry = make_entry(strings[3]);
+    TEST_ASSERT_EQUAL_INT(1, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 3));
+    TEST_ASSERT_EQUAL_PTR(strings[0], evicted[0].buffptr);
+    TEST_ASSERT_EQUAL_UINT(3, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_UINT(21, aesd_circular_buffer_total_size(&buffer));
+    aesd_circular_buffer_free(&buffer);
+}
+
+void test_circular_buffer_evict_by_budget()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry evicted[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    const char *strings[] = { "a\n", "bb\n", "ccc\n", "dddddddddd\n", "0123456789abcdef\n" };
+    size_t offset;
+
+    aesd_circular_buffer_init(&buffer);
+    aesd_circular_buffer_set_byte_budget(&buffer, 12);
+    for (int i = 0; i < 3; i++) {
+        struct aesd_buffer_entry entry = make_entry(strings[i]);
+        TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 1));
+    }
+    TEST_ASSERT_EQUAL_UINT(9, aesd_circular_buffer_total_size(&buffer));
+
+    // 11 more bytes only fit once all three entries are gone
+    struct aesd_buffer_entry entry = make_entry(strings[3]);
+    TEST_ASSERT_EQUAL_INT(-ENOBUFS, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 2));
+    TEST_ASSERT_EQUAL_UINT(3, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_INT(3, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 3));
+    for (int i = 0; i < 3; i++)
+        TEST_ASSERT_EQUAL_PTR(strings[i], evicted[i].buffptr);
+    TEST_ASSERT_EQUAL_UINT(1, aesd_circular_buffer_count(&buffer));
+    TEST_ASSERT_EQUAL_UINT(11, aesd_circular_buffer_total_size(&buffer));
+    TEST_ASSERT_EQUAL_PTR(strings[3],
+            aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 10, &offset)->buffptr);
+    TEST_ASSERT_EQUAL_UINT(10, offset);
+
+    // Larger than the whole budget: rejected without evicting anything
+    entry = make_entry(strings[4]);
+    TEST_ASSERT_EQUAL_INT(-EFBIG, aesd_circular_buffer_add_entry_evict(&buffer, &entry, evicted, 10));
+    TEST_ASSERT_EQUAL_UINT(11, aesd_circular_buffer_total_size(&buffer));
+
+    entry = make_entry(strings[0]);
+    TEST_ASSERT_EQUAL_INT(1, aesd_circular_buffer_add_entry_evict(&buffer, &entry, NULL, 0));
+    TEST_ASSERT_EQUAL_UINT(2, aesd_circular_buffer_total_size(&buffer));
+}
@@ -0,0 +1,38 @@
+#include "unity.h"
+#include <string.h>
+#include <sys/uio.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+void test_circular_buffer_fill_iovec()
+{
+    struct aesd_circular_buffer buffer;
+    struct iovec iov[4];
+    size_t bytes;
+    const char *strings[] = { "write1\n", "", "write3\n", "write4\n", "write5\n" };
+
+    TEST_ASSERT_EQUAL_INT(0, aesd_circular_buffer_init_capacity(&buffer, 4));
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_fill_iovec(&buffer, 0, 10, iov, 4, &bytes));
+    TEST_ASSERT_EQUAL_UINT(0, bytes);
+    for (int i = 0; i < 5; i++) {
+        struct aesd_buffer_entry entry = { .buffptr = strings[i], .size = strlen(strings[i]) };
+        aesd_circular_buffer_add_entry(&buffer, &entry); // Evicts "write1\n"
+    }
+
+    // From the middle of "write3\n" to the middle of "write5\n", skipping the empty entry
+    TEST_ASSERT_EQUAL_UINT(3, aesd_circular_buffer_fill_iovec(&buffer, 5, 11, iov, 4, &bytes));
+    TEST_ASSERT_EQUAL_UINT(11, bytes);
+    TEST_ASSERT_EQUAL_PTR(strings[2] + 5, iov[0].iov_base);
+    TEST_ASSERT_EQUAL_UINT(2, iov[0].iov_len);
+    TEST_ASSERT_EQUAL_PTR(strings[3], iov[1].iov_base);
+    TEST_ASSERT_EQUAL_UINT(7, iov[1].iov_len);
+    TEST_ASSERT_EQUAL_PTR(strings[4], iov[2].iov_base);
+    TEST_ASSERT_EQUAL_UINT(2, iov[2].iov_len);
+
+    // Stops at the end of the data, and when the iovec array is full
+    TEST_ASSERT_EQUAL_UINT(2, aesd_circular_buffer_fill_iovec(&buffer, 10, 100, iov, 4, &bytes));
+    TEST_ASSERT_EQUAL_UINT(11, bytes);
+    TEST_ASSERT_EQUAL_UINT(1, aesd_circular_buffer_fill_iovec(&buffer, 0, 100, iov, 1, &bytes));
+    TEST_ASSERT_EQUAL_UINT(7, bytes);
+    TEST_ASSERT_EQUAL_UINT(0, aesd_circular_buffer_fill_iovec(&buffer, 21, 1, iov, 4, &bytes));
+    aesd_circular_buffer_free(&buffer);
+}